@@ -25,19 +25,66 @@
 #define NABU_H_
 
 // Standard headers
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <random>
 #include <regex>
 #include <set>
+#include <sstream>
+#include <stdexcept>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+// Vector extensions for the lexer prefilter (picked at runtime)
+#if !defined(NABU_NO_SIMD) && defined(__GNUC__) \
+		&& (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define NABU_SIMD_X86 1
+
+#else
+
+#define NABU_SIMD_X86 0
+
+#endif
+
+// Memory mapping for lexer caches, only with NABU_MMAP (defined alike in
+// 	every translation unit) since the POSIX headers declare open,
+// 	close, read, ... globally; caches are read into memory otherwise
+#if defined(NABU_MMAP) && (defined(__unix__) || defined(__APPLE__))
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NABU_POSIX 1
+
+#else
+
+#define NABU_POSIX 0
+
+#endif
+
 namespace nabu {
 
 // Built-in typename system for debugging
@@ -558,6 +605,81 @@ public:
 	}
 };
 
+// Feeder over a borrowed span of characters, which also notes the
+// 	furthest index read (so lexers know how much input a rule needed);
+// 	checkpoints are ints, so a rule sees at most INT_MAX bytes of it
+class SpanFeeder : public Feeder {
+	const char	*_source;
+	size_t		_size;
+	size_t		_index = 0;
+
+	// Bytes passed to getc so far, _size + 1 if the end was seen
+	mutable size_t	_read = 0;
+public:
+	SpanFeeder(const char *str, size_t size)
+			: _source(str), _size(std::min <size_t> (size, INT_MAX)) {}
+
+	// Virtual function overrides
+	void move(int step) override {
+		if (step < 0)
+			_index -= std::min(_index, (size_t) -(long long) step);
+		else
+			_index = std::min(_size, _index + step);
+	}
+
+	char getc() const override {
+		_read = std::max(_read, _index + 1);
+		if (_index >= _size)
+			return EOF;
+		return _source[_index];
+	}
+
+	virtual int cindex() const override {
+		return _index;
+	}
+
+	virtual size_t size() const override {
+		return _size;
+	}
+
+	size_t offset() const {
+		return _index;
+	}
+
+	size_t read() const {
+		return _read;
+	}
+
+	// Position tracking
+	virtual size_t line() const override {
+		return 1 + std::count(_source, _source + _index, '\n');
+	}
+
+	virtual size_t col() const override {
+		size_t col = 1;
+		for (size_t i = _index; i > 0 && _source[i - 1] != '\n'; i--)
+			col++;
+		return col;
+	}
+
+	virtual std::string get_line(size_t line) const override {
+		const char *begin = _source;
+		const char *end = _source + _size;
+		for (size_t l = 1; l < line && begin < end; l++) {
+			begin = (const char *) memchr(begin, '\n', end - begin);
+			begin = begin ? begin + 1 : end;
+		}
+
+		const char *nl = (const char *) memchr(begin, '\n', end - begin);
+		return std::string(begin, nl ? nl : end);
+	}
+
+	virtual const std::string &source() const override {
+		static const std::string none;
+		return none;
+	}
+};
+
 // Color constants
 #define NABU_RESET_COLOR "\033[0m"
 #define NABU_BOLD_COLOR "\033[1m"
@@ -1851,6 +1973,28 @@ struct token {
 	}
 };
 
+// Unlexable text, queued in its place when lexing recovers from errors
+struct lexerror {};
+
+template <>
+struct token <lexerror> {
+	static constexpr int id = -2;
+	static constexpr const char *regex = "";
+	static constexpr bool overloaded = false;
+
+#ifdef NABU_DEBUG_PARSER
+
+	static constexpr const char *name = "lexerror";
+
+#endif
+
+	using cast_type = int;
+
+	static cast_type cast(const std::string &) {
+		return 0;
+	}
+};
+
 #ifdef NABU_DEBUG_PARSER
 
 // Token with a regex (dummy)
@@ -2006,6 +2150,19 @@ struct token <void> {
 	COUNTER_INC(int);				\
 	mk_overloaded_token(T, COUNTER_READ(int), regex, R, ftn)
 
+// Regex of tokens recognized by a rule instead, which matches nothing
+#define NABU_RULE_REGEX "[^\\s\\S]"
+
+// Token recognized by a rules:: rule (only with the built-in DFA, which
+// 	lexlists with rule tokens always use)
+#define mk_rule_token(T, value, Rule)			\
+	mk_token(T, value, NABU_RULE_REGEX)		\
+	lexer_rule(T, Rule)
+
+#define auto_mk_rule_token(T, Rule)			\
+	COUNTER_INC(int);				\
+	mk_rule_token(T, COUNTER_READ(int), Rule)
+
 
 // #define set_nid(T) to set id to incremented value
 
@@ -2015,6 +2172,18 @@ struct _lexvalue {
 	int line = -1;
 	int col = -1;
 
+	// Symbol of the text, for tokens declared with intern
+	uint32_t symbol = ~0u;
+
+	// Matched text, borrowed from the source buffer of the Queue
+	std::string_view text;
+
+	// Alternatives taken by the rd options which returned this
+	// 	lexicon, above a leading 1 bit (see rd::option), and the
+	// 	full words pushed before them if there are more
+	uint64_t options = 1;
+	std::unique_ptr <std::vector <uint64_t>> spilled;
+
 #ifdef NABU_DEBUG_PARSER
 
 	const char *name;
@@ -2030,9 +2199,19 @@ struct _lexvalue {
 
 #endif
 
+	void reset_options() {
+		options = 1;
+		spilled.reset();
+	}
+
 	// Since this is a base class
 	virtual ~_lexvalue() {}
 
+	// Owned string value, if any (see get <std::string>)
+	virtual const std::string *owned() const {
+		return nullptr;
+	}
+
 	// Convert to string
 	virtual std::string str() const {
 
@@ -2040,7 +2219,8 @@ struct _lexvalue {
 
 		return "(name: " + std::string(name)
 			+ ", line: " + std::to_string(line)
-			+ ", col: " + std::to_string(col) + ")";
+			+ ", col: " + std::to_string(col)
+			+ ", text: \"" + std::string(text) + "\")";
 
 #else
 
@@ -2119,6 +2299,10 @@ struct lexvalue <std::string> : public _lexvalue {
 
 #endif
 
+	const std::string *owned() const override {
+		return &value;
+	}
+
 	// convert to string
 	std::string str() const override {
 
@@ -2159,501 +2343,5472 @@ using lexvec = lexvalue <vec>;
 // Predefined lexids
 mk_id(std::vector <lexicon>, 1);
 
-// Queue of lexicons (for parsers)
-using Queue = std::deque <lexicon>;
+// Sparse index of line starts: line and column are found by binary
+// 	search and line text is only copied out when an error needs it
+class line_index {
+	const char		*_source = nullptr;
+	size_t			_size = 0;
+	int			_base = 1;
 
-// Overload get for lexicons
-template <class T>
-T get(lexicon lptr)
-{
-	// TODO: same NABU_NO_RTTI dilemma here
-	return ((lexvalue <T> *) lptr.get())->value;
-}
+	// Offset of the start of each line
+	std::vector <size_t>	_starts;
+public:
+	line_index() {}
+
+	// Indexes source[0, size), whose first line is numbered base
+	line_index(const char *source, size_t size, int base = 1)
+			: _source(source), _size(size), _base(base) {
+		_starts.push_back(0);
+
+		// memchr is vectorized by the C library
+		const char *end = source + size;
+		const char *p = source;
+		while ((p = (const char *) memchr(p, '\n', end - p))) {
+			p++;
+			_starts.push_back(p - source);
+		}
+	}
 
-// Cast to vector
-inline std::vector <lexicon> tovec(lexicon lptr)
-{
-	return ((lexvec *) lptr.get())->value;
-}
+	line_index(const std::string &source, int base = 1)
+			: line_index(source.data(), source.size(), base) {}
 
-// Lexicon factory
-template <class T>
-inline lexicon make(const T &x)
-{
+	// Numbers of the first and last lines
+	int first() const {
+		return _base;
+	}
 
-#ifdef NABU_DEBUG_PARSER
+	int last() const {
+		return _base + _starts.size() - 1;
+	}
 
-		lexicon lptr(new lexvalue <T> (
-			x, 
-			token <decltype(x)> ::id,
-			token <decltype(x)> ::name
-		));
+	// Line and column of an offset
+	std::pair <int, int> locate(size_t offset) const {
+		size_t k = std::upper_bound(_starts.begin(), _starts.end(), offset)
+			- _starts.begin() - 1;
+		return {_base + k, offset - _starts[k] + 1};
+	}
 
-#else
+	// Offset of the start of a line
+	size_t start(int line) const {
+		return _starts[line - _base];
+	}
 
-		lexicon lptr(new lexvalue <T> (
-			x, token <decltype(x)> ::id
-		));
+	// Text of a line, without the newline
+	std::string text(int line) const {
+		size_t k = line - _base;
+		if (k >= _starts.size())
+			return "";
 
-#endif
+		size_t begin = _starts[k];
+		size_t end = (k + 1 < _starts.size()) ? _starts[k + 1] - 1 : _size;
+		return std::string(_source + begin, end - begin);
+	}
+};
 
-	return lptr;
-}
+// Locates increasing offsets in amortized constant time
+class line_cursor {
+	const line_index	&_index;
+	int			_line;
+public:
+	line_cursor(const line_index &index)
+			: _index(index), _line(index.first()) {}
 
-// Read a an expected token
-template <class E>
-bool expect(Queue &q)
-{
-	if (q.empty())
-		return false;
+	// Starts at the line of an offset
+	line_cursor(const line_index &index, size_t offset)
+			: _index(index), _line(index.locate(offset).first) {}
 
-	lexicon lptr = q.front();
-	if (lptr->id != token <E> ::id)
-		return false;
+	const line_index &index() const {
+		return _index;
+	}
 
-	q.pop_front();
-	return true;
-}
+	std::pair <int, int> locate(size_t offset) {
+		// Fall back to a search when going backwards
+		if (offset < _index.start(_line))
+			_line = _index.locate(offset).first;
 
-// Get element from queue if it matches
-template <class E, class T>
-bool expect(Queue &q, T &value)
-{
-	if (q.empty())
-		return false;
+		while (_line < _index.last() && _index.start(_line + 1) <= offset)
+			_line++;
 
-	lexicon lptr = q.front();
-	if (lptr->id == token <E> ::id) {
-		value = get <T> (lptr);
-		q.pop_front();
-		return true;
+		return {_line, offset - _index.start(_line) + 1};
 	}
+};
 
-	return false;
-}
+// Dense ids for distinct token texts, so that equal names are compared
+// 	(and looked up) as integers and stored once
+class symbol_table {
+	// Names, in a deque so the keys of the map stay valid
+	std::deque <std::string>				_names;
+	std::unordered_map <std::string_view, uint32_t>		_ids;
+public:
+	static constexpr uint32_t none = ~0u;
 
-// Defines the sequence of lexical rules
-template <class T>
-struct lexlist {
-	static constexpr bool tail = true;
+	symbol_table() {}
 
-	using next = void;
-};
+	// No copy constructor (the keys point into this)
+	symbol_table(const symbol_table &) = delete;
+	symbol_table &operator=(const symbol_table &) = delete;
 
-#define lexlist_next(A, B) 				\
-	template <>					\
-	struct nabu::parser::lexlist <A> {		\
-		static constexpr bool tail = false;	\
-		using next = B;				\
-	};
+	// Symbol of a name, added if new
+	uint32_t add(std::string_view name) {
+		auto it = _ids.find(name);
+		if (it != _ids.end())
+			return it->second;
 
-// Defines which lexicons should be ignored
-template <class T>
-struct ignore {
-	static constexpr bool value = false;
-};
+		uint32_t sym = _names.size();
+		_names.emplace_back(name);
+		_ids.emplace(_names.back(), sym);
+		return sym;
+	}
 
-#define ignore(T)					\
-	template <>					\
-	struct nabu::parser::ignore <T> {		\
-		static constexpr bool value = true;	\
-	};
+	// Symbol of a name, or none
+	uint32_t find(std::string_view name) const {
+		auto it = _ids.find(name);
+		return (it == _ids.end()) ? none : it->second;
+	}
 
-// Get Nth regex from lexlist
-template <class T, int N>
-struct get_regex {
-	static constexpr int id = get_regex <typename lexlist <T> ::next, N - 1> ::id;
-};
+	std::string_view name(uint32_t sym) const {
+		return _names[sym];
+	}
 
-template <class T>
-struct get_regex <T, 0> {
-	static constexpr const char *regex = token <T> ::regex;
+	size_t size() const {
+		return _names.size();
+	}
 };
 
-// Concatenate regex for a set of lexical rules (lexlist)
-template <class T>
-std::string concat()
-{
-	std::string result = "(" + std::string(token <T> ::regex) + ")";
-	if (!lexlist <T> ::tail)
-		result += "|" + concat <typename lexlist <T> ::next> ();
-	return result;
-}
+// Handle of a token in a Queue
+using token_handle = uint32_t;
 
-// Handle regex compilation errors
-template <class T>
-void regex_error_handle()
-{
-	try {
-		std::regex r(token <T> ::regex);
+class Queue;
 
-		if (!lexlist <T> ::tail)
-			regex_error_handle <typename lexlist <T> ::next> ();
-	} catch (std::regex_error &e) {
-		std::string id = "(id: " + std::to_string(token <T> ::id) + ")";
+struct lexer_mode;
 
-#ifdef NABU_DEBUG_PARSER
+// Stack of lexer modes in effect from a source offset on
+struct mode_switch {
+	size_t					offset;
+	std::vector <const lexer_mode *>	modes;
+};
 
-		id = "(name: " + std::string(token <T> ::name) + ")";
+// Source of tokens which adds them to a Queue as a parser asks for
+// 	them, instead of the Queue being lexed up front (see lexq_directed,
+// 	lexq_pipelined and lexq_stream); any producer can implement it
+struct token_feed {
+	virtual ~token_feed() {}
 
-#endif
+	// Makes the front token of q one with the id (any token if id is
+	// 	-1), lexing as much as needed; false if there is none
+	virtual bool next(Queue &q, int id) = 0;
 
-		std::cerr << "[nabu] Error compiling regex " << id << ":\n";
-		std::cerr << "\t" << e.what() << std::endl;
+	// Whether the tokens depend on the ids asked for, in which case
+	// 	the parser does not look ahead
+	virtual bool directed() const {
+		return false;
+	}
+};
 
-		std::string gen = "(" + std::string(token <T> ::regex) + ")";
-		std::cerr << "\tgenerated regex: \"" << gen << "\"" << std::endl;
+// Queue of lexicons (for parsers), stored as parallel arrays of token
+// 	ids, source spans and value slots
+//
+// 	Plain tokens are only turned into lexicons when they are looked
+// 	at (the lexicon is then kept in the value slot), so lexing them
+// 	allocates nothing and the parser compares ids straight from the
+// 	id array; the source buffer is kept alive for token text
+class Queue {
+	static constexpr uint32_t _none = ~0u;
+	static constexpr size_t npos = std::string::npos;
+
+	std::vector <int>		_ids;
+	std::vector <size_t>		_offsets;
+	std::vector <uint32_t>		_lengths;
+	std::vector <uint32_t>		_symbols;
+	mutable std::vector <uint32_t>	_values;
+
+	// End of the source read to lex each token and all before it
+	// 	(npos if unknown), which bounds what an edit can change
+	std::vector <size_t>		_reach;
+	size_t				_mark = npos;
+
+	// Value slots (a deque, so references stay valid), numbered from
+	// 	_first_slot on, and the number of slots no token uses anymore
+	mutable std::deque <lexicon>	_lexicons;
+	uint32_t			_first_slot = 0;
+	size_t				_dropped = 0;
+
+	// Handle of the front token, and of the first one kept (the arrays
+	// 	start there, the tokens before it were released)
+	token_handle			_front = 0;
+	token_handle			_base = 0;
+
+	lexicon &slot(uint32_t v) const {
+		return _lexicons[v - _first_slot];
+	}
+
+	uint32_t add_slot(const lexicon &lptr) const {
+		_lexicons.push_back(lptr);
+		return _first_slot + _lexicons.size() - 1;
+	}
+
+	// Frees the lexicons of unused value slots once they are the
+	// 	majority, and the unused slots at the front; the slots in use
+	// 	stay where they are, so references to them remain valid
+	void compact() {
+		if (2 * _dropped <= _lexicons.size())
+			return;
 
-		exit(1);
+		std::vector <bool> used(_lexicons.size(), false);
+		for (uint32_t v : _values) {
+			if (v != _none)
+				used[v - _first_slot] = true;
+		}
+
+		for (size_t i = 0; i < used.size(); i++) {
+			if (!used[i])
+				_lexicons[i].reset();
+		}
+
+		for (size_t i = 0; i < used.size() && !used[i]; i++) {
+			_lexicons.pop_front();
+			_first_slot++;
+		}
+
+		_dropped = 0;
 	}
-}
+
+	// Creates the lexicon of a plain token
+	const lexicon &materialize(token_handle h) const {
+		h -= _base;
+
+		int line = -1;
+		int col = -1;
+		if (source) {
+			auto loc = lines.locate(_offsets[h]);
+			line = loc.first;
+			col = loc.second;
+		}
 
 #ifdef NABU_DEBUG_PARSER
 
-#define ID_TYPE const char *
-#define ID_NULL nullptr
+		const char *name = names ? names(_ids[h]) : "?";
+		lexicon lptr(new _lexvalue(_ids[h], name, line, col));
 
 #else
 
-#define ID_TYPE int
-#define ID_NULL -1
+		lexicon lptr(new _lexvalue(_ids[h], line, col));
 
 #endif
 
-// Check for cyclic list
-template <class T>
-ID_TYPE is_cyclic(std::set <int> &ids)
-{
-	int id = token <T> ::id;
+		if (source)
+			lptr->text = std::string_view(source->data() + _offsets[h], _lengths[h]);
 
-#ifdef NABU_DEBUG_PARSER
-	
-	if (ids.find(id) != ids.end())
-		return token <T> ::name;
+		lptr->symbol = _symbols[h];
 
-	if (lexlist <T> ::tail)
-		return nullptr;
+		_values[h] = add_slot(lptr);
+		return _lexicons.back();
+	}
 
-#else
+	// Stores a lexicon in a slot
+	void assign(token_handle h, const lexicon &lptr) {
+		h -= _base;
 
-	if (ids.find(id) != ids.end())
-		return id;
+		_ids[h] = lptr->id;
+		_symbols[h] = lptr->symbol;
+		_values[h] = add_slot(lptr);
+	}
+public:
+	// Lexed source and its line index
+	std::shared_ptr <const std::string>	source;
+	line_index				lines;
 
-	if (lexlist <T> ::tail)
-		return -1;
+	// Symbols of interned tokens, made by the first one lexed
+	std::shared_ptr <symbol_table>		symbols;
 
-#endif
+	// Changes of the mode stack, by offset, for lexlists with modes
+	std::vector <mode_switch>		switches;
 
-	ids.insert(id);
-	return is_cyclic <typename lexlist <T> ::next> (ids);
-}
+	// Lexer adding tokens while the queue is parsed, if any (shared by
+	// 	copies of the queue, of which only one should be parsed)
+	std::shared_ptr <token_feed>		feed;
 
-// Get length of lexlist
-template <class T>
-constexpr int _length()
+#ifdef NABU_DEBUG_PARSER
+
+	// Name of a token id, for the lexicons made of lazy tokens
+	const char *(*names)(int) = nullptr;
+
+#endif
+
+	// Iterator over the remaining tokens
+	class iterator {
+		const Queue	*_q;
+		token_handle	_h;
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = lexicon;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const lexicon *;
+		using reference = const lexicon &;
+
+		iterator(const Queue *q, token_handle h) : _q(q), _h(h) {}
+
+		const lexicon &operator*() const {
+			return _q->at(_h);
+		}
+
+		iterator &operator++() {
+			_h++;
+			return *this;
+		}
+
+		bool operator==(const iterator &it) const {
+			return _h == it._h;
+		}
+
+		bool operator!=(const iterator &it) const {
+			return _h != it._h;
+		}
+	};
+
+	// Number of remaining tokens
+	size_t size() const {
+		return handles() - _front;
+	}
+
+	bool empty() const {
+		return _front >= handles();
+	}
+
+	// Token ids, without creating lexicons
+	int id(size_t i) const {
+		return _ids[_front - _base + i];
+	}
+
+	int front_id() const {
+		return empty() ? -1 : _ids[_front - _base];
+	}
+
+	// Lexicon of a token by handle
+	const lexicon &at(token_handle h) const {
+		uint32_t v = _values[h - _base];
+		if (v == _none)
+			return materialize(h);
+
+		return slot(v);
+	}
+
+	// Lexicons of the remaining tokens
+	const lexicon &operator[](size_t i) const {
+		return at(_front + i);
+	}
+
+	const lexicon &front() const {
+		return at(_front);
+	}
+
+	const lexicon &back() const {
+		return at(handles() - 1);
+	}
+
+	iterator begin() const {
+		return iterator(this, _front);
+	}
+
+	iterator end() const {
+		return iterator(this, handles());
+	}
+
+	// Handle of the front token, and moving back to one
+	token_handle cursor() const {
+		return _front;
+	}
+
+	void rewind(token_handle h) {
+		_front = h;
+	}
+
+	// Source spans of tokens by handle, and the range of handles
+	size_t offset(token_handle h) const {
+		return _offsets[h - _base];
+	}
+
+	size_t length(token_handle h) const {
+		return _lengths[h - _base];
+	}
+
+	size_t reach(token_handle h) const {
+		return _reach[h - _base];
+	}
+
+	int id_at(token_handle h) const {
+		return _ids[h - _base];
+	}
+
+	// Symbol of a token by handle (symbol_table::none if not interned)
+	uint32_t symbol(token_handle h) const {
+		return _symbols[h - _base];
+	}
+
+	token_handle base() const {
+		return _base;
+	}
+
+	size_t handles() const {
+		return _base + _ids.size();
+	}
+
+	// Bytes of token storage (lexicons are estimated)
+	size_t memory() const {
+		auto bytes = [](const auto &v) {
+			return v.capacity() * sizeof(v[0]);
+		};
+
+		return bytes(_ids) + bytes(_offsets) + bytes(_lengths)
+			+ bytes(_symbols) + bytes(_values) + bytes(_reach)
+			+ _lexicons.size() * (sizeof(lexicon) + sizeof(_lexvalue));
+	}
+
+	// Sets the reach of the tokens pushed next
+	void mark(size_t reach) {
+		_mark = reach;
+	}
+
+	// Appends a plain token
+	void push(int id, size_t offset, size_t length, uint32_t symbol = _none) {
+		_ids.push_back(id);
+		_offsets.push_back(offset);
+		_lengths.push_back(length);
+		_symbols.push_back(symbol);
+		_values.push_back(_none);
+		_reach.push_back(_mark);
+	}
+
+	// Appends a token with a value
+	void push(size_t offset, size_t length, const lexicon &lptr) {
+		push(lptr->id, offset, length, lptr->symbol);
+		assign(handles() - 1, lptr);
+	}
+
+	// Deque interface
+	void push_back(const lexicon &lptr) {
+		push(0, 0, lptr);
+	}
+
+	// Prepends a token, with an empty span where the front token starts
+	// 	(the slot of the token before the front is reused if any)
+	void push_front(const lexicon &lptr) {
+		if (_front > _base && at(_front - 1) == lptr) {
+			_front--;
+			return;
+		}
+
+		size_t k = _front - _base;
+		size_t offset = 0;
+		if (k < _ids.size())
+			offset = _offsets[k];
+		else if (k > 0)
+			offset = _offsets[k - 1] + _lengths[k - 1];
+
+		// A reused slot keeps its reach, the source before it is the same
+		if (_front > _base) {
+			_dropped += (_values[k - 1] != _none);
+			_offsets[k - 1] = offset;
+			_lengths[k - 1] = 0;
+			assign(--_front, lptr);
+			return;
+		}
+
+		// Before the released tokens if there are any, otherwise
+		// 	the handles of all tokens move up
+		if (_base > 0)
+			_front = --_base;
+
+		_ids.insert(_ids.begin(), lptr->id);
+		_offsets.insert(_offsets.begin(), offset);
+		_lengths.insert(_lengths.begin(), 0);
+		_symbols.insert(_symbols.begin(), lptr->symbol);
+		_values.insert(_values.begin(), add_slot(lptr));
+		_reach.insert(_reach.begin(), npos);
+	}
+
+	void pop_front() {
+		if (!empty())
+			_front++;
+	}
+
+	// Drops the tokens from a handle on
+	void truncate(token_handle h) {
+		if (h >= handles())
+			return;
+
+		_front = std::min(_front, h);
+
+		h = std::max(h, _base) - _base;
+		for (size_t i = h; i < _ids.size(); i++)
+			_dropped += (_values[i] != _none);
+
+		_ids.resize(h);
+		_offsets.resize(h);
+		_lengths.resize(h);
+		_symbols.resize(h);
+		_values.resize(h);
+		_reach.resize(h);
+	}
+
+	// Releases the tokens before a handle (at most the front one), which
+	// 	can no longer be looked at; their storage is freed once they
+	// 	are the majority, and other handles stay the same (the last
+	// 	one is kept, feeds resume lexing after it)
+	void release(token_handle h) {
+		h = std::min(h, _front);
+		if (h > 0)
+			h--;
+
+		if (h <= _base || 2 * (h - _base) < _ids.size())
+			return;
+
+		size_t k = h - _base;
+		for (size_t i = 0; i < k; i++)
+			_dropped += (_values[i] != _none);
+
+		auto drop = [&](auto &v) {
+			v.erase(v.begin(), v.begin() + k);
+		};
+
+		drop(_ids);
+		drop(_offsets);
+		drop(_lengths);
+		drop(_symbols);
+		drop(_values);
+		drop(_reach);
+
+		_base = h;
+		compact();
+	}
+
+	void clear() {
+		_ids.clear();
+		_offsets.clear();
+		_lengths.clear();
+		_symbols.clear();
+		_values.clear();
+		_reach.clear();
+		_lexicons.clear();
+		_first_slot = 0;
+		_dropped = 0;
+		_front = 0;
+		_base = 0;
+		_mark = npos;
+	}
+
+	// Replaces the tokens [first, last) with those of q, which lexed
+	// 	the new source of this queue up to reach; the source offsets
+	// 	after them move by delta and lexicons already made are
+	// 	updated for the new source (source and lines must be set
+	// 	first, old_lines is the line index of the old source; no
+	// 	tokens may have been released)
+	void splice(token_handle first, token_handle last, const Queue &q,
+			std::ptrdiff_t delta, size_t reach, const line_index &old_lines) {
+		// Lines of the tail move by dline, and columns only on the
+		// 	line where the edit ends
+		int dline = lines.last() - old_lines.last();
+		int edit_line = -1;
+		size_t new_start = 0;
+		if (last < _ids.size()) {
+			size_t at = _offsets[last];
+			edit_line = old_lines.locate(at).first;
+			new_start = lines.start(lines.locate(at + delta).first);
+		}
+
+		for (size_t h = last; h < _ids.size(); h++) {
+			if (_values[h] != _none) {
+				const lexicon &lptr = slot(_values[h]);
+				if (lptr->line == edit_line)
+					lptr->col = _offsets[h] + delta - new_start + 1;
+
+				lptr->line += dline;
+			}
+
+			_offsets[h] += delta;
+			if (_reach[h] != npos)
+				_reach[h] = std::max(_reach[h] + delta, reach);
+		}
+
+		// Values of the replaced tokens are dropped, q's are added
+		std::vector <uint32_t> values;
+		for (uint32_t v : q._values) {
+			if (v == _none) {
+				values.push_back(_none);
+				continue;
+			}
+
+			values.push_back(add_slot(q.slot(v)));
+		}
+
+		for (size_t h = first; h < last; h++)
+			_dropped += (_values[h] != _none);
+
+		auto replace = [&](auto &dst, const auto &src) {
+			dst.erase(dst.begin() + first, dst.begin() + last);
+			dst.insert(dst.begin() + first, src.begin(), src.end());
+		};
+
+		replace(_ids, q._ids);
+		replace(_offsets, q._offsets);
+		replace(_lengths, q._lengths);
+		replace(_symbols, q._symbols);
+		replace(_reach, q._reach);
+		replace(_values, values);
+
+		_front = std::min <token_handle> (_front, first);
+
+		// Rebase the text of the lexicons on the new source
+		for (size_t h = 0; h < _ids.size(); h++) {
+			if (_values[h] == _none)
+				continue;
+
+			const lexicon &lptr = slot(_values[h]);
+			if (!lptr->owned())
+				lptr->text = std::string_view(source->data() + _offsets[h], _lengths[h]);
+		}
+
+		compact();
+	}
+};
+
+// Overload get for lexicons
+template <class T>
+T get(lexicon lptr)
+{
+	// TODO: same NABU_NO_RTTI dilemma here
+	return ((lexvalue <T> *) lptr.get())->value;
+}
+
+// Borrow the matched text of a token, valid while its Queue is alive
+template <>
+inline std::string_view get <std::string_view> (lexicon lptr)
+{
+	return lptr->text;
+}
+
+// Owned string value of a token, copied from its text when the token
+// 	has no string value of its own
+template <>
+inline std::string get <std::string> (lexicon lptr)
+{
+	if (const std::string *str = lptr->owned())
+		return *str;
+
+	return std::string(lptr->text);
+}
+
+// Symbol of an interned token, symbol_table::none for other tokens
+inline uint32_t get_symbol(lexicon lptr)
+{
+	return lptr->symbol;
+}
+
+// Cast to vector
+inline std::vector <lexicon> tovec(lexicon lptr)
+{
+	return ((lexvec *) lptr.get())->value;
+}
+
+// Elements of a vector lexicon without copying them, valid as long as
+// 	the lexicon is
+inline const std::vector <lexicon> &children(const lexicon &lptr)
+{
+	return ((const lexvec *) lptr.get())->value;
+}
+
+// Lexicon factory
+template <class T>
+inline lexicon make(const T &x)
+{
+
+#ifdef NABU_DEBUG_PARSER
+
+		lexicon lptr(new lexvalue <T> (
+			x, 
+			token <decltype(x)> ::id,
+			token <decltype(x)> ::name
+		));
+
+#else
+
+		lexicon lptr(new lexvalue <T> (
+			x, token <decltype(x)> ::id
+		));
+
+#endif
+
+	return lptr;
+}
+
+// Read a an expected token
+template <class E>
+bool expect(Queue &q)
+{
+	if (q.empty())
+		return false;
+
+	if (q.front_id() != token <E> ::id)
+		return false;
+
+	q.pop_front();
+	return true;
+}
+
+// Get element from queue if it matches
+template <class E, class T>
+bool expect(Queue &q, T &value)
+{
+	if (q.empty())
+		return false;
+
+	if (q.front_id() == token <E> ::id) {
+		value = get <T> (q.front());
+		q.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+// Defines the sequence of lexical rules
+template <class T>
+struct lexlist {
+	static constexpr bool tail = true;
+
+	using next = void;
+};
+
+#define lexlist_next(A, B) 				\
+	template <>					\
+	struct nabu::parser::lexlist <A> {		\
+		static constexpr bool tail = false;	\
+		using next = B;				\
+	};
+
+// Defines which lexicons should be ignored
+template <class T>
+struct ignore {
+	static constexpr bool value = false;
+};
+
+#define ignore(T)					\
+	template <>					\
+	struct nabu::parser::ignore <T> {		\
+		static constexpr bool value = true;	\
+	};
+
+// Defines which lexicons have their text interned as symbols
+template <class T>
+struct intern {
+	static constexpr bool value = false;
+};
+
+#define intern(T)					\
+	template <>					\
+	struct nabu::parser::intern <T> {		\
+		static constexpr bool value = true;	\
+	};
+
+// Length of a match of a rule at the start of s[0, n), 0 if none; read
+// 	is set to the number of bytes it looked at (n + 1 if it hit the
+// 	end)
+template <class Rule>
+size_t rule_match(const char *s, size_t n, size_t &read)
+{
+	SpanFeeder fd(s, n);
+
+	ret rptr = rules::rule <Rule> ::value(&fd);
+	read = fd.read();
+
+	return rptr ? fd.offset() : 0;
+}
+
+// Tokens recognized by a rule, declared with mk_rule_token
+template <class T>
+struct lexer_rule {
+	static constexpr bool value = false;
+
+	static size_t match(const char *, size_t, size_t &read) {
+		read = 0;
+		return 0;
+	}
+};
+
+#define lexer_rule(T, Rule)							\
+	template <>								\
+	struct nabu::parser::lexer_rule <T> {					\
+		static constexpr bool value = true;				\
+										\
+		static size_t match(const char *s, size_t n, size_t &read) {	\
+			return nabu::parser::rule_match <Rule> (s, n, read);	\
+		}								\
+	};
+
+// Start conditions: after a token, lexing may go on with another
+// 	lexlist (named by its head) until a token pops back out of it
+template <class T>
+struct lexer_action {
+	static constexpr int value = 0;		// 1 pushes mode, -1 pops
+
+	using mode = void;
+};
+
+#define lexer_push(T, Mode)				\
+	template <>					\
+	struct nabu::parser::lexer_action <T> {		\
+		static constexpr int value = 1;		\
+		using mode = Mode;			\
+	};
+
+#define lexer_pop(T)					\
+	template <>					\
+	struct nabu::parser::lexer_action <T> {		\
+		static constexpr int value = -1;	\
+		using mode = void;			\
+	};
+
+// Get Nth regex from lexlist
+template <class T, int N>
+struct get_regex {
+	static constexpr int id = get_regex <typename lexlist <T> ::next, N - 1> ::id;
+};
+
+template <class T>
+struct get_regex <T, 0> {
+	static constexpr const char *regex = token <T> ::regex;
+};
+
+// Nth token of a lexlist
+template <class T, size_t N>
+struct lexlist_at {
+	using type = typename lexlist_at <typename lexlist <T> ::next, N - 1> ::type;
+};
+
+template <class T>
+struct lexlist_at <T, 0> {
+	using type = T;
+};
+
+// Concatenate regex for a set of lexical rules (lexlist)
+template <class T>
+std::string concat()
+{
+	std::string result = "(" + std::string(token <T> ::regex) + ")";
+	if (!lexlist <T> ::tail)
+		result += "|" + concat <typename lexlist <T> ::next> ();
+	return result;
+}
+
+// Handle regex compilation errors
+template <class T>
+void regex_error_handle()
+{
+	try {
+		std::regex r(token <T> ::regex);
+
+		if (!lexlist <T> ::tail)
+			regex_error_handle <typename lexlist <T> ::next> ();
+	} catch (std::regex_error &e) {
+		std::string id = "(id: " + std::to_string(token <T> ::id) + ")";
+
+#ifdef NABU_DEBUG_PARSER
+
+		id = "(name: " + std::string(token <T> ::name) + ")";
+
+#endif
+
+		std::cerr << "[nabu] Error compiling regex " << id << ":\n";
+		std::cerr << "\t" << e.what() << std::endl;
+
+		std::string gen = "(" + std::string(token <T> ::regex) + ")";
+		std::cerr << "\tgenerated regex: \"" << gen << "\"" << std::endl;
+
+		exit(1);
+	}
+}
+
+#ifdef NABU_DEBUG_PARSER
+
+#define ID_TYPE const char *
+#define ID_NULL nullptr
+
+#else
+
+#define ID_TYPE int
+#define ID_NULL -1
+
+#endif
+
+// Check for cyclic list
+template <class T>
+ID_TYPE is_cyclic(std::set <int> &ids)
+{
+	int id = token <T> ::id;
+
+#ifdef NABU_DEBUG_PARSER
+	
+	if (ids.find(id) != ids.end())
+		return token <T> ::name;
+
+	if (lexlist <T> ::tail)
+		return nullptr;
+
+#else
+
+	if (ids.find(id) != ids.end())
+		return id;
+
+	if (lexlist <T> ::tail)
+		return -1;
+
+#endif
+
+	ids.insert(id);
+	return is_cyclic <typename lexlist <T> ::next> (ids);
+}
+
+// Get length of lexlist
+template <class T>
+constexpr int _length()
+{
+	if (lexlist <T> ::tail)
+		return 1;
+
+	return 1 + _length <typename lexlist <T> ::next> ();
+}
+
+// Whether each token of a lexlist is ignored, in order
+template <class T>
+void ignored_tokens(std::vector <bool> &ignored)
+{
+	ignored.push_back(ignore <T> ::value);
+	if constexpr (!lexlist <T> ::tail)
+		ignored_tokens <typename lexlist <T> ::next> (ignored);
+}
+
+template <class Head>
+std::vector <bool> ignored_tokens()
+{
+	std::vector <bool> ignored;
+	ignored_tokens <Head> (ignored);
+	return ignored;
+}
+
+// Whether each token of a lexlist is interned, in order
+template <class T>
+void interned_tokens(std::vector <bool> &interned)
+{
+	interned.push_back(intern <T> ::value);
+	if constexpr (!lexlist <T> ::tail)
+		interned_tokens <typename lexlist <T> ::next> (interned);
+}
+
+// Whether a token of the lexlist is recognized by a rule
+template <class T>
+constexpr bool has_rules()
+{
+	if (lexer_rule <T> ::value)
+		return true;
+
+	if constexpr (!lexlist <T> ::tail)
+		return has_rules <typename lexlist <T> ::next> ();
+
+	return false;
+}
+
+// Whether a token of the lexlist switches modes
+template <class T>
+constexpr bool has_modes()
+{
+	if (lexer_action <T> ::value != 0)
+		return true;
+
+	if constexpr (!lexlist <T> ::tail)
+		return has_modes <typename lexlist <T> ::next> ();
+
+	return false;
+}
+
+// Abort if the lexlist is cyclic
+template <class Head>
+void check_cyclic()
+{
+	std::set <int> ids;
+
+	ID_TYPE id = is_cyclic <Head> (ids);
+	if (id != ID_NULL) {
+
+#ifdef NABU_DEBUG_PARSER
+
+		std::string id_str = id;
+
+#else
+
+		std::string id_str = std::to_string(id);
+
+#endif
+
+		std::cerr << "[nabu] Error: lexical rule list is cyclic at (id: "
+			<< id_str << ")" << std::endl;
+		exit(1);
+	}
+}
+
+// Regex engines available to lexq
+struct std_engine {};		// std::regex, first alternative wins
+struct dfa_engine {};		// Built-in minimized DFA, longest match wins
+struct static_engine {};	// Same DFA, built at compile time
+
+#ifndef NABU_LEXER_ENGINE
+
+#define NABU_LEXER_ENGINE nabu::parser::std_engine
+
+#endif
+
+// Engine used to lex a lexlist, defaults to NABU_LEXER_ENGINE
+template <class Head>
+struct lexer_engine {
+	using type = NABU_LEXER_ENGINE;
+};
+
+#define lexer_engine(Head, E)				\
+	template <>					\
+	struct nabu::parser::lexer_engine <Head> {	\
+		using type = E;				\
+	};
+
+// Compile the regex for a set of lexical rules
+template <class Head>
+inline std::regex compile()
+{
+	// First make sure the list is not cyclic
+	check_cyclic <Head> ();
+
+	try {
+		return std::regex(
+			concat <Head> (),
+			std::regex::ECMAScript | std::regex::optimize
+		);
+	} catch (std::regex_error &e) {
+		regex_error_handle <Head> ();
+	}
+
+	return std::regex {};
+}
+
+// Built-in regex engine
+//	the regexes of a lexlist are parsed into syntax trees, joined
+//	into a single Thompson NFA and turned into a minimized DFA over
+//	byte equivalence classes; lexing is then one table lookup per byte
+namespace dfa {
+
+// Set of bytes
+struct charset {
+	uint64_t bits[4] = {0, 0, 0, 0};
+
+	constexpr void set(unsigned char c) {
+		bits[c >> 6] |= 1ull << (c & 63);
+	}
+
+	constexpr void set(unsigned char a, unsigned char b) {
+		for (int c = a; c <= b; c++)
+			set(c);
+	}
+
+	constexpr bool test(unsigned char c) const {
+		return bits[c >> 6] & (1ull << (c & 63));
+	}
+
+	constexpr void merge(const charset &cs) {
+		for (int i = 0; i < 4; i++)
+			bits[i] |= cs.bits[i];
+	}
+
+	constexpr void invert() {
+		for (int i = 0; i < 4; i++)
+			bits[i] = ~bits[i];
+	}
+
+	constexpr bool operator==(const charset &cs) const {
+		for (int i = 0; i < 4; i++) {
+			if (bits[i] != cs.bits[i])
+				return false;
+		}
+
+		return true;
+	}
+};
+
+// Fixed capacity vector, usable in constant expressions
+template <class T, size_t N>
+struct fixed_vector {
+	T data[N] = {};
+	size_t count = 0;
+
+	constexpr void push_back(const T &x) {
+		if (count >= N)
+			throw std::length_error("nabu: static lexer capacity exceeded");
+
+		data[count++] = x;
+	}
+
+	constexpr size_t size() const {
+		return count;
+	}
+
+	constexpr T &operator[](size_t i) {
+		return data[i];
+	}
+
+	constexpr const T &operator[](size_t i) const {
+		return data[i];
+	}
+};
+
+// Regex syntax tree node
+struct node {
+	enum kind_t {
+		empty,		// Matches the empty string
+		chars,		// Matches one byte from cs
+		cat,		// left then right
+		alt,		// left or right
+		rep		// left repeated [min, max] times (max < 0 is unbounded)
+	};
+
+	kind_t kind = empty;
+	charset cs;
+
+	int left = -1;
+	int right = -1;
+
+	int min = 0;
+	int max = -1;
+};
+
+// Recursive descent parser for the supported ECMAScript subset:
+//	literals, escapes (\d \w \s \D \W \S \n \t \xHH ...), dot,
+//	bracket classes with ranges and negation, groups (also (?:...)),
+//	alternation and the *, +, ?, {n}, {n,}, {n,m} quantifiers
+//
+// 	Lazy quantifiers are accepted but behave greedily (the lexer
+// 	always takes the longest match); anchors, lookaheads and
+// 	backreferences are rejected
+template <class Nodes>
+struct regex_parser {
+	const char *s;
+	size_t i = 0;
+
+	Nodes &nodes;
+
+	// Error message and position, if any
+	const char *error = nullptr;
+	size_t epos = 0;
+
+	constexpr regex_parser(const char *str, Nodes &n) : s(str), nodes(n) {}
+
+	constexpr int fail(const char *msg) {
+		if (!error) {
+			error = msg;
+			epos = i;
+		}
+
+		return -1;
+	}
+
+	constexpr int push(const node &n) {
+		nodes.push_back(n);
+		return nodes.size() - 1;
+	}
+
+	constexpr int push(node::kind_t kind, int left, int right = -1) {
+		node n;
+		n.kind = kind;
+		n.left = left;
+		n.right = right;
+		return push(n);
+	}
+
+	// Entire regex
+	constexpr int parse() {
+		int root = parse_alt();
+		if (root >= 0 && s[i] != '\0')
+			return fail("unmatched ')'");
+
+		return root;
+	}
+
+	// a|b|...
+	constexpr int parse_alt() {
+		int left = parse_cat();
+		while (left >= 0 && s[i] == '|') {
+			i++;
+
+			int right = parse_cat();
+			if (right < 0)
+				return -1;
+
+			left = push(node::alt, left, right);
+		}
+
+		return left;
+	}
+
+	// abc...
+	constexpr int parse_cat() {
+		int left = push(node::empty, -1);
+		while (s[i] != '\0' && s[i] != '|' && s[i] != ')') {
+			int right = parse_repeat();
+			if (right < 0)
+				return -1;
+
+			left = push(node::cat, left, right);
+		}
+
+		return left;
+	}
+
+	// Decimal number for {n,m}
+	constexpr int parse_int() {
+		if (!digit(s[i]))
+			return -1;
+
+		int n = 0;
+		while (digit(s[i])) {
+			n = 10 * n + (s[i++] - '0');
+			if (n > 1000)
+				return fail("repetition count is too large");
+		}
+
+		return n;
+	}
+
+	// atom followed by quantifiers
+	constexpr int parse_repeat() {
+		int atom = parse_atom();
+		while (atom >= 0) {
+			node n;
+			n.kind = node::rep;
+			n.left = atom;
+
+			char c = s[i];
+			if (c == '*') {
+				n.min = 0, n.max = -1;
+			} else if (c == '+') {
+				n.min = 1, n.max = -1;
+			} else if (c == '?') {
+				n.min = 0, n.max = 1;
+			} else if (c == '{') {
+				i++;
+				if ((n.min = parse_int()) < 0)
+					return fail("expected number in {}");
+
+				n.max = n.min;
+				if (s[i] == ',') {
+					i++;
+					n.max = (s[i] == '}') ? -1 : parse_int();
+					if (s[i] != '}' || (n.max >= 0 && n.max < n.min))
+						return fail("bad range in {}");
+				}
+
+				if (s[i] != '}')
+					return fail("expected '}'");
+			} else {
+				break;
+			}
+
+			i++;
+
+			// Lazy quantifiers: longest match is taken regardless
+			if (s[i] == '?')
+				i++;
+
+			atom = push(n);
+		}
+
+		return atom;
+	}
+
+	// Single byte or group
+	constexpr int parse_atom() {
+		node n;
+		n.kind = node::chars;
+
+		char c = s[i];
+		switch (c) {
+		case '(':
+			i++;
+			if (s[i] == '?') {
+				if (s[i + 1] != ':')
+					return fail("lookaheads are not supported");
+
+				i += 2;
+			}
+
+			{
+				int inner = parse_alt();
+				if (inner < 0)
+					return -1;
+
+				if (s[i] != ')')
+					return fail("expected ')'");
+
+				i++;
+				return inner;
+			}
+		case '[':
+			i++;
+			if (!parse_class(n.cs))
+				return -1;
+
+			return push(n);
+		case '.':
+			i++;
+			n.cs.set('\n');
+			n.cs.set('\r');
+			n.cs.invert();
+			return push(n);
+		case '\\':
+			i++;
+			if (!parse_escape(n.cs, false))
+				return -1;
+
+			return push(n);
+		case '*': case '+': case '?': case '{':
+			return fail("nothing to repeat");
+		case '^': case '$':
+			return fail("anchors are not supported");
+		default:
+			i++;
+			n.cs.set(c);
+			return push(n);
+		}
+	}
+
+	// Character class tests (the <cctype> ones are not constexpr)
+	static constexpr bool digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	// Hex digit value
+	static constexpr int hex(char c) {
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		return -1;
+	}
+
+	// Escape sequence after the backslash
+	constexpr bool parse_escape(charset &cs, bool in_class) {
+		char c = s[i++];
+		switch (c) {
+		case '\0':
+			i--;
+			fail("trailing backslash");
+			return false;
+		case 'd':
+			cs.set('0', '9');
+			return true;
+		case 'D':
+			cs.set('0', '9');
+			cs.invert();
+			return true;
+		case 'w':
+		case 'W':
+			cs.set('a', 'z');
+			cs.set('A', 'Z');
+			cs.set('0', '9');
+			cs.set('_');
+			if (c == 'W')
+				cs.invert();
+			return true;
+		case 's':
+		case 'S':
+			cs.set(' ');
+			cs.set('\t', '\r');
+			if (c == 'S')
+				cs.invert();
+			return true;
+		case 'n':
+			cs.set('\n');
+			return true;
+		case 't':
+			cs.set('\t');
+			return true;
+		case 'r':
+			cs.set('\r');
+			return true;
+		case 'f':
+			cs.set('\f');
+			return true;
+		case 'v':
+			cs.set('\v');
+			return true;
+		case '0':
+			cs.set('\0');
+			return true;
+		case 'b':
+			// Backspace in a class, word boundary outside
+			if (in_class) {
+				cs.set('\b');
+				return true;
+			}
+
+			fail("word boundaries are not supported");
+			return false;
+		case 'x': {
+			int hi = hex(s[i]);
+			int lo = (hi < 0) ? -1 : hex(s[i + 1]);
+			if (lo < 0) {
+				fail("expected two hex digits after \\x");
+				return false;
+			}
+
+			i += 2;
+			cs.set(16 * hi + lo);
+			return true;
+		}
+		default:
+			if (digit(c)) {
+				fail("backreferences are not supported");
+				return false;
+			}
+
+			// Escaped literal
+			cs.set(c);
+			return true;
+		}
+	}
+
+	// Bracket class, after the '['
+	constexpr bool parse_class(charset &cs) {
+		bool negate = false;
+		if (s[i] == '^') {
+			negate = true;
+			i++;
+		}
+
+		while (s[i] != ']') {
+			if (s[i] == '\0') {
+				fail("expected ']'");
+				return false;
+			}
+
+			// Single class item
+			charset item;
+			int lo = -1;
+			if (s[i] == '\\') {
+				i++;
+				if (!parse_escape(item, true))
+					return false;
+
+				// Only single characters can start ranges
+				int count = 0;
+				for (int c = 0; c < 256; c++) {
+					if (item.test(c)) {
+						lo = c;
+						count++;
+					}
+				}
+
+				if (count != 1)
+					lo = -1;
+			} else {
+				lo = (unsigned char) s[i++];
+				item.set(lo);
+			}
+
+			// Range
+			if (s[i] == '-' && s[i + 1] != ']' && s[i + 1] != '\0' && lo >= 0) {
+				i++;
+
+				int hi = (unsigned char) s[i++];
+				if (hi == '\\') {
+					charset end;
+					if (!parse_escape(end, true))
+						return false;
+
+					hi = -1;
+					for (int c = 0; c < 256; c++) {
+						if (end.test(c))
+							hi = c;
+					}
+				}
+
+				if (hi < lo) {
+					fail("bad range in character class");
+					return false;
+				}
+
+				item.set(lo, hi);
+			}
+
+			cs.merge(item);
+		}
+
+		i++;
+		if (negate)
+			cs.invert();
+
+		return true;
+	}
+};
+
+// State of a Thompson NFA
+struct nfa_state {
+	int on = -1;		// Index into sets, or -1 if none
+	int next = -1;		// Transition on a byte from sets[on]
+	int eps[2] = {-1, -1};	// Epsilon transitions
+	int accept = -1;	// Index of the accepted regex
+};
+
+// Thompson NFA for several regexes at once
+template <class States, class Sets>
+struct basic_nfa {
+	States states;
+	Sets sets;
+
+	constexpr int add() {
+		states.push_back(nfa_state {});
+		return states.size() - 1;
+	}
+
+	constexpr void link(int from, int to) {
+		nfa_state &st = states[from];
+		if (st.eps[0] < 0)
+			st.eps[0] = to;
+		else
+			st.eps[1] = to;
+	}
+
+	constexpr int charset_index(const charset &cs) {
+		for (size_t k = 0; k < sets.size(); k++) {
+			if (sets[k] == cs)
+				return k;
+		}
+
+		sets.push_back(cs);
+		return sets.size() - 1;
+	}
+
+	// Builds a fragment for a syntax tree, returns start and end states
+	template <class Nodes>
+	constexpr std::pair <int, int> build(const Nodes &nodes, int n) {
+		const node &nd = nodes[n];
+		switch (nd.kind) {
+		case node::empty: {
+			int s = add();
+			return {s, s};
+		}
+		case node::chars: {
+			int s = add();
+			int e = add();
+
+			states[s].on = charset_index(nd.cs);
+			states[s].next = e;
+			return {s, e};
+		}
+		case node::cat: {
+			auto a = build(nodes, nd.left);
+			auto b = build(nodes, nd.right);
+			link(a.second, b.first);
+			return {a.first, b.second};
+		}
+		case node::alt: {
+			auto a = build(nodes, nd.left);
+			auto b = build(nodes, nd.right);
+
+			int s = add();
+			int e = add();
+
+			link(s, a.first);
+			link(s, b.first);
+			link(a.second, e);
+			link(b.second, e);
+			return {s, e};
+		}
+		case node::rep: {
+			int s = add();
+			int e = s;
+
+			// Mandatory copies
+			for (int k = 0; k < nd.min; k++) {
+				auto a = build(nodes, nd.left);
+				link(e, a.first);
+				e = a.second;
+			}
+
+			if (nd.max < 0) {
+				// Kleene star on the tail
+				auto a = build(nodes, nd.left);
+				int f = add();
+
+				link(e, a.first);
+				link(e, f);
+				link(a.second, a.first);
+				link(a.second, f);
+				return {s, f};
+			}
+
+			// Optional copies
+			int f = add();
+			for (int k = nd.min; k < nd.max; k++) {
+				auto a = build(nodes, nd.left);
+				link(e, a.first);
+				link(e, f);
+				e = a.second;
+			}
+
+			link(e, f);
+			return {s, f};
+		}
+		}
+
+		return {-1, -1};
+	}
+};
+
+using nfa = basic_nfa <std::vector <nfa_state>, std::vector <charset>>;
+
+// Fixed-string tokens (keywords) looked up with a perfect hash
+// 	instead of being spelled out in the automaton
+struct keywords {
+	std::vector <std::string>	words;
+	std::vector <int>		indices;
+
+	// Word of each hash slot, -1 when empty
+	std::vector <int>		slots;
+	uint32_t			seed = 0;
+
+	size_t				minlen = ~(size_t) 0;
+	size_t				maxlen = 0;
+
+	static uint32_t hash(const char *s, size_t n, uint32_t seed) {
+		uint32_t h = 2166136261u ^ seed;
+		for (size_t i = 0; i < n; i++) {
+			h ^= (uint8_t) s[i];
+			h *= 16777619u;
+		}
+
+		return h;
+	}
+
+	bool empty() const {
+		return words.empty();
+	}
+
+	void add(const std::string &word, int index) {
+		words.push_back(word);
+		indices.push_back(index);
+		minlen = std::min(minlen, word.size());
+		maxlen = std::max(maxlen, word.size());
+	}
+
+	// Searches a seed without collisions, false if none is found
+	bool finish() {
+		if (words.empty())
+			return true;
+
+		for (size_t size = 2; size <= (words.size() << 6); size <<= 1) {
+			if (size < 2 * words.size())
+				continue;
+
+			for (seed = 0; seed < 64; seed++) {
+				slots.assign(size, -1);
+
+				bool ok = true;
+				for (size_t w = 0; w < words.size() && ok; w++) {
+					const std::string &word = words[w];
+					int &slot = slots[hash(word.data(), word.size(), seed) & (size - 1)];
+					ok = (slot < 0);
+					slot = w;
+				}
+
+				if (ok)
+					return true;
+			}
+		}
+
+		slots.clear();
+		return false;
+	}
+
+	// Token index of a keyword, -1 if s[0, n) is not one
+	int find(const char *s, size_t n) const {
+		if (n < minlen || n > maxlen)
+			return -1;
+
+		int w = slots[hash(s, n, seed) & (slots.size() - 1)];
+		if (w < 0 || words[w].size() != n || memcmp(words[w].data(), s, n))
+			return -1;
+
+		return indices[w];
+	}
+};
+
+// Read-only view of DFA tables, shared by every automaton storage
+struct tables {
+	const uint8_t *classes = nullptr;
+	int nclasses = 0;
+	int start = 0;
+
+	// Transitions are table[state * nclasses + class], -1 when dead
+	const int *table = nullptr;
+
+	// Accepted regex index per state, -1 if not accepting
+	const int *accept = nullptr;
+
+	// Keywords left out of the automaton, if any
+	const keywords *kw = nullptr;
+
+	// Longest non-empty match at the start of s[0, n), returns its
+	// 	length (0 if none) and sets the index of the accepted regex
+	size_t match(const char *s, size_t n, int &index) const {
+		bool alive;
+		return match(s, n, index, alive);
+	}
+
+	// Same as above, also reports whether the automaton was still
+	// 	alive at the end of the input (more input could extend
+	// 	the match)
+	size_t match(const char *s, size_t n, int &index, bool &alive) const {
+		size_t read;
+		return match(s, n, index, alive, read);
+	}
+
+	// Same as above, also sets the number of bytes the result depends
+	// 	on (the match and the byte which ended it)
+	size_t match(const char *s, size_t n, int &index, bool &alive, size_t &read) const {
+		size_t len = 0;
+		index = -1;
+		alive = false;
+
+		int st = start;
+		size_t k = 0;
+		for (; k < n; k++) {
+			st = table[st * nclasses + classes[(uint8_t) s[k]]];
+			if (st < 0)
+				break;
+
+			if (accept[st] >= 0) {
+				index = accept[st];
+				len = k + 1;
+			}
+		}
+
+		alive = (k == n);
+		read = alive ? n : k + 1;
+
+		// A keyword ties with the token that spelled it out
+		if (kw && len > 0) {
+			int w = kw->find(s, len);
+			if (w >= 0 && w < index)
+				index = w;
+		}
+
+		return len;
+	}
+};
+
+// Minimized DFA with byte equivalence classes
+struct automaton {
+	uint8_t classes[256] = {};
+	int nclasses = 0;
+	int start = 0;
+
+	std::vector <int> table;
+	std::vector <int> accept;
+
+	keywords kw;
+
+	tables view() const {
+		return {classes, nclasses, start, table.data(), accept.data(),
+			kw.empty() ? nullptr : &kw};
+	}
+
+	size_t match(const char *s, size_t n, int &index) const {
+		return view().match(s, n, index);
+	}
+};
+
+// Builds the automaton for a sequence of regexes, earlier
+// 	regexes take priority on matches of equal length
+struct builder {
+	std::vector <node> nodes;
+	std::vector <int> roots;
+
+	// Text of each regex which matches a single fixed string
+	std::vector <std::string> literals;
+	std::vector <bool> fixed;
+
+	// Adds a regex, returns false and sets error info on failure
+	bool add(const char *regex, const char *&error, size_t &epos) {
+		regex_parser <std::vector <node>> parser(regex, nodes);
+
+		int root = parser.parse();
+		if (root < 0) {
+			error = parser.error;
+			epos = parser.epos;
+			return false;
+		}
+
+		std::string text;
+		roots.push_back(root);
+		fixed.push_back(literal(root, text));
+		literals.push_back(text);
+		return true;
+	}
+
+	// Appends the string matched by a subtree, false if it can
+	// 	match more than one
+	bool literal(int root, std::string &out) const {
+		const node &nd = nodes[root];
+		if (nd.kind == node::empty)
+			return true;
+
+		if (nd.kind == node::cat)
+			return literal(nd.left, out) && literal(nd.right, out);
+
+		if (nd.kind != node::chars)
+			return false;
+
+		int c = -1;
+		for (int b = 0; b < 256; b++) {
+			if (!nd.cs.test(b))
+				continue;
+
+			if (c >= 0)
+				return false;
+
+			c = b;
+		}
+
+		out += (char) c;
+		return (c >= 0);
+	}
+
+	// Epsilon closure of a set of NFA states (sorted)
+	static void closure(const nfa &m, std::vector <int> &set, std::vector <char> &seen) {
+		std::vector <int> stack = set;
+		for (int s : set)
+			seen[s] = 1;
+
+		while (!stack.empty()) {
+			int s = stack.back();
+			stack.pop_back();
+
+			for (int t : m.states[s].eps) {
+				if (t >= 0 && !seen[t]) {
+					seen[t] = 1;
+					set.push_back(t);
+					stack.push_back(t);
+				}
+			}
+		}
+
+		for (int s : set)
+			seen[s] = 0;
+
+		std::sort(set.begin(), set.end());
+	}
+
+	// Keywords (fixed strings of two or more bytes which some other
+	// 	regex also matches, like identifiers do) are left out of the
+	// 	automaton and found by hashing the matches instead
+	automaton build() const {
+		std::vector <bool> skip(roots.size(), false);
+		for (size_t k = 0; k < roots.size(); k++)
+			skip[k] = fixed[k] && literals[k].size() > 1;
+
+		if (std::find(skip.begin(), skip.end(), true) == skip.end())
+			return build(skip);
+
+		automaton reduced = build(skip);
+
+		keywords kw;
+		bool kept = false;
+		for (size_t k = 0; k < roots.size(); k++) {
+			if (!skip[k])
+				continue;
+
+			const std::string &word = literals[k];
+
+			// Duplicates never win over the first one
+			bool dup = false;
+			for (size_t j = 0; j < k && !dup; j++)
+				dup = fixed[j] && literals[j] == word;
+
+			int index;
+			if (dup || reduced.match(word.data(), word.size(), index) == word.size()) {
+				if (!dup)
+					kw.add(word, k);
+			} else {
+				skip[k] = false;
+				kept = true;
+			}
+		}
+
+		if (!kw.finish())
+			return build(std::vector <bool> (roots.size(), false));
+
+		automaton a = kept ? build(skip) : reduced;
+		a.kw = kw;
+		return a;
+	}
+
+	// Automaton of the regexes which are not skipped
+	automaton build(const std::vector <bool> &skip) const {
+		// Join every regex under one start state
+		nfa m;
+
+		int start = m.add();
+		for (size_t k = 0; k < roots.size(); k++) {
+			if (skip[k])
+				continue;
+
+			auto frag = m.build(nodes, roots[k]);
+			m.states[frag.second].accept = k;
+			m.link(start, frag.first);
+
+			// Keep at most two epsilons per state
+			if (k + 1 < roots.size()) {
+				int split = m.add();
+				m.link(start, split);
+				start = split;
+			}
+		}
+
+		// Reroot at the first split
+		start = 0;
+
+		automaton a;
+
+		// Equivalence classes: bytes that no charset tells apart
+		std::vector <int> cls(256, 0);
+		int ncls = 1;
+		for (const charset &cs : m.sets) {
+			std::map <std::pair <int, bool>, int> split;
+			for (int c = 0; c < 256; c++) {
+				auto key = std::make_pair(cls[c], cs.test(c));
+				auto it = split.find(key);
+				if (it == split.end())
+					it = split.insert({key, (int) split.size()}).first;
+
+				cls[c] = it->second;
+			}
+
+			ncls = split.size();
+		}
+
+		std::vector <int> rep(ncls, -1);
+		for (int c = 0; c < 256; c++) {
+			a.classes[c] = cls[c];
+			if (rep[cls[c]] < 0)
+				rep[cls[c]] = c;
+		}
+
+		a.nclasses = ncls;
+
+		// Subset construction
+		std::vector <char> seen(m.states.size(), 0);
+		std::map <std::vector <int>, int> ids;
+		std::vector <std::vector <int>> sets;
+		std::vector <int> table;
+		std::vector <int> accept;
+
+		std::vector <int> init {start};
+		closure(m, init, seen);
+		ids[init] = 0;
+		sets.push_back(init);
+
+		for (size_t d = 0; d < sets.size(); d++) {
+			int acc = -1;
+			for (int s : sets[d]) {
+				int k = m.states[s].accept;
+				if (k >= 0 && (acc < 0 || k < acc))
+					acc = k;
+			}
+
+			accept.push_back(acc);
+
+			for (int c = 0; c < ncls; c++) {
+				std::vector <int> next;
+				for (int s : sets[d]) {
+					const nfa_state &st = m.states[s];
+					if (st.on >= 0 && m.sets[st.on].test(rep[c])
+							&& !seen[st.next]) {
+						seen[st.next] = 1;
+						next.push_back(st.next);
+					}
+				}
+
+				for (int s : next)
+					seen[s] = 0;
+
+				if (next.empty()) {
+					table.push_back(-1);
+					continue;
+				}
+
+				closure(m, next, seen);
+
+				auto it = ids.find(next);
+				if (it == ids.end()) {
+					it = ids.insert({next, (int) sets.size()}).first;
+					sets.push_back(next);
+				}
+
+				table.push_back(it->second);
+			}
+		}
+
+		// Moore minimization, starting from the accept partition
+		size_t nstates = accept.size();
+
+		std::vector <int> block(nstates);
+		size_t nblocks = 0;
+		{
+			std::map <int, int> initial;
+			for (size_t d = 0; d < nstates; d++) {
+				auto it = initial.find(accept[d]);
+				if (it == initial.end())
+					it = initial.insert({accept[d], (int) initial.size()}).first;
+
+				block[d] = it->second;
+			}
+
+			nblocks = initial.size();
+		}
+
+		while (true) {
+			std::map <std::vector <int>, int> signatures;
+			std::vector <int> next(nstates);
+			for (size_t d = 0; d < nstates; d++) {
+				std::vector <int> sig {block[d]};
+				for (int c = 0; c < ncls; c++) {
+					int t = table[d * ncls + c];
+					sig.push_back(t < 0 ? -1 : block[t]);
+				}
+
+				auto it = signatures.find(sig);
+				if (it == signatures.end())
+					it = signatures.insert({sig, (int) signatures.size()}).first;
+
+				next[d] = it->second;
+			}
+
+			block.swap(next);
+			if (signatures.size() == nblocks)
+				break;
+
+			nblocks = signatures.size();
+		}
+
+		// Emit the minimized automaton
+		a.start = block[0];
+		a.table.assign(nblocks * ncls, -1);
+		a.accept.assign(nblocks, -1);
+		for (size_t d = 0; d < nstates; d++) {
+			a.accept[block[d]] = accept[d];
+			for (int c = 0; c < ncls; c++) {
+				int t = table[d * ncls + c];
+				a.table[block[d] * ncls + c] = (t < 0) ? -1 : block[t];
+			}
+		}
+
+		return a;
+	}
+};
+
+// Capacities of the compile-time DFA construction
+#ifndef NABU_STATIC_MAX_NODES
+
+#define NABU_STATIC_MAX_NODES 1024
+
+#endif
+
+#ifndef NABU_STATIC_MAX_NFA
+
+#define NABU_STATIC_MAX_NFA 1024
+
+#endif
+
+#ifndef NABU_STATIC_MAX_DFA
+
+#define NABU_STATIC_MAX_DFA 256
+
+#endif
+
+#ifndef NABU_STATIC_MAX_SETS
+
+#define NABU_STATIC_MAX_SETS 128
+
+#endif
+
+using static_nodes = fixed_vector <node, NABU_STATIC_MAX_NODES>;
+using static_nfa = basic_nfa <
+	fixed_vector <nfa_state, NABU_STATIC_MAX_NFA>,
+	fixed_vector <charset, NABU_STATIC_MAX_SETS>
+>;
+
+// Checks the syntax of a regex during constant evaluation
+constexpr bool static_check(const char *regex)
+{
+	static_nodes nodes;
+	regex_parser <static_nodes> parser(regex, nodes);
+	return parser.parse() >= 0;
+}
+
+// Automaton produced by the compile-time construction, sized by the
+// 	capacities rather than by the actual number of states and classes
+struct static_result {
+	uint8_t classes[256] = {};
+	int nclasses = 0;
+	int start = 0;
+	int nstates = 0;
+
+	int table[NABU_STATIC_MAX_DFA * 256] = {};
+	int accept[NABU_STATIC_MAX_DFA] = {};
+};
+
+// Same construction as builder::build, with fixed storage, bitsets
+// 	for NFA state sets and linear searches in place of maps
+constexpr static_result build_static(const char *const *regexes, size_t n)
+{
+	constexpr size_t words = (NABU_STATIC_MAX_NFA + 63) / 64;
+
+	static_nodes nodes;
+	static_nfa m;
+
+	int start = m.add();
+	for (size_t k = 0; k < n; k++) {
+		regex_parser <static_nodes> parser(regexes[k], nodes);
+
+		int root = parser.parse();
+		if (root < 0)
+			throw std::invalid_argument("nabu: invalid token regex");
+
+		auto frag = m.build(nodes, root);
+		m.states[frag.second].accept = k;
+		m.link(start, frag.first);
+
+		if (k + 1 < n) {
+			int split = m.add();
+			m.link(start, split);
+			start = split;
+		}
+	}
+
+	static_result r;
+
+	// Equivalence classes
+	int cls[256] = {};
+	int ncls = 1;
+	for (size_t k = 0; k < m.sets.size(); k++) {
+		int remap[512] = {};
+		for (int &x : remap)
+			x = -1;
+
+		int count = 0;
+		for (int c = 0; c < 256; c++) {
+			int key = 2 * cls[c] + m.sets[k].test(c);
+			if (remap[key] < 0)
+				remap[key] = count++;
+
+			cls[c] = remap[key];
+		}
+
+		ncls = count;
+	}
+
+	int rep[256] = {};
+	for (int &x : rep)
+		x = -1;
+
+	for (int c = 0; c < 256; c++) {
+		r.classes[c] = cls[c];
+		if (rep[cls[c]] < 0)
+			rep[cls[c]] = c;
+	}
+
+	r.nclasses = ncls;
+
+	// Subset construction over bitsets
+	size_t used = (m.states.size() + 63) / 64;
+
+	uint64_t sets[NABU_STATIC_MAX_DFA][words] = {};
+	int nsets = 0;
+
+	int stack[NABU_STATIC_MAX_NFA] = {};
+	auto closure = [&](uint64_t *set) {
+		int top = 0;
+		for (size_t w = 0; w < used; w++) {
+			for (uint64_t b = set[w]; b; b &= b - 1)
+				stack[top++] = 64 * w + __builtin_ctzll(b);
+		}
+
+		while (top > 0) {
+			int s = stack[--top];
+			for (int t : m.states[s].eps) {
+				if (t >= 0 && !(set[t >> 6] & (1ull << (t & 63)))) {
+					set[t >> 6] |= 1ull << (t & 63);
+					stack[top++] = t;
+				}
+			}
+		}
+	};
+
+	sets[0][0] = 1;
+	closure(sets[0]);
+	nsets = 1;
+
+	int accept[NABU_STATIC_MAX_DFA] = {};
+	int table[NABU_STATIC_MAX_DFA * 256] = {};
+	for (int d = 0; d < nsets; d++) {
+		int acc = -1;
+		for (size_t w = 0; w < used; w++) {
+			for (uint64_t b = sets[d][w]; b; b &= b - 1) {
+				int k = m.states[64 * w + __builtin_ctzll(b)].accept;
+				if (k >= 0 && (acc < 0 || k < acc))
+					acc = k;
+			}
+		}
+
+		accept[d] = acc;
+
+		for (int c = 0; c < ncls; c++) {
+			uint64_t next[words] = {};
+			bool empty = true;
+			for (size_t w = 0; w < used; w++) {
+				for (uint64_t b = sets[d][w]; b; b &= b - 1) {
+					const nfa_state &st = m.states[64 * w + __builtin_ctzll(b)];
+					if (st.on >= 0 && m.sets[st.on].test(rep[c])) {
+						next[st.next >> 6] |= 1ull << (st.next & 63);
+						empty = false;
+					}
+				}
+			}
+
+			if (empty) {
+				table[d * ncls + c] = -1;
+				continue;
+			}
+
+			closure(next);
+
+			int found = -1;
+			for (int e = 0; e < nsets && found < 0; e++) {
+				bool same = true;
+				for (size_t w = 0; w < used && same; w++)
+					same = (sets[e][w] == next[w]);
+
+				if (same)
+					found = e;
+			}
+
+			if (found < 0) {
+				if (nsets >= NABU_STATIC_MAX_DFA)
+					throw std::length_error("nabu: static lexer capacity exceeded");
+
+				for (size_t w = 0; w < used; w++)
+					sets[nsets][w] = next[w];
+
+				found = nsets++;
+			}
+
+			table[d * ncls + c] = found;
+		}
+	}
+
+	// Moore minimization, a state joins the block of the first
+	// 	earlier state with an identical signature
+	int block[NABU_STATIC_MAX_DFA] = {};
+	int nblocks = 0;
+	for (int d = 0; d < nsets; d++) {
+		block[d] = -1;
+		for (int e = 0; e < d && block[d] < 0; e++) {
+			if (accept[e] == accept[d])
+				block[d] = block[e];
+		}
+
+		if (block[d] < 0)
+			block[d] = nblocks++;
+	}
+
+	while (true) {
+		int next[NABU_STATIC_MAX_DFA] = {};
+		int count = 0;
+		for (int d = 0; d < nsets; d++) {
+			next[d] = -1;
+			for (int e = 0; e < d && next[d] < 0; e++) {
+				bool same = (block[e] == block[d]);
+				for (int c = 0; c < ncls && same; c++) {
+					int td = table[d * ncls + c];
+					int te = table[e * ncls + c];
+					same = ((td < 0) ? -1 : block[td]) == ((te < 0) ? -1 : block[te]);
+				}
+
+				if (same)
+					next[d] = next[e];
+			}
+
+			if (next[d] < 0)
+				next[d] = count++;
+		}
+
+		for (int d = 0; d < nsets; d++)
+			block[d] = next[d];
+
+		if (count == nblocks)
+			break;
+
+		nblocks = count;
+	}
+
+	r.start = block[0];
+	r.nstates = nblocks;
+	for (int d = 0; d < nsets; d++) {
+		r.accept[block[d]] = accept[d];
+		for (int c = 0; c < ncls; c++) {
+			int t = table[d * ncls + c];
+			r.table[block[d] * ncls + c] = (t < 0) ? -1 : block[t];
+		}
+	}
+
+	return r;
+}
+
+// Exactly sized automaton, stored as constant data
+template <int S, int C>
+struct static_automaton {
+	uint8_t classes[256] = {};
+	int start = 0;
+
+	int table[S * C] = {};
+	int accept[S] = {};
+
+	tables view() const {
+		return {classes, C, start, table, accept};
+	}
+};
+
+template <int S, int C>
+constexpr static_automaton <S, C> shrink(const static_result &r)
+{
+	static_automaton <S, C> a;
+	for (int c = 0; c < 256; c++)
+		a.classes[c] = r.classes[c];
+
+	a.start = r.start;
+	for (int k = 0; k < S * C; k++)
+		a.table[k] = r.table[k];
+
+	for (int k = 0; k < S; k++)
+		a.accept[k] = r.accept[k];
+
+	return a;
+}
+
+// Set of bytes, also kept as a short list of either its members or
+// 	its non-members when one of them fits (for vector compares)
+struct byteset {
+	bool	member[256] = {};
+	uint8_t	list[16] = {};
+	int	nlist = -1;
+	bool	negated = false;
+
+	void finish() {
+		int n = 0;
+		for (int c = 0; c < 256; c++)
+			n += member[c];
+
+		negated = (n > 128);
+		if ((negated ? 256 - n : n) > 16)
+			return;
+
+		nlist = 0;
+		for (int c = 0; c < 256; c++) {
+			if (member[c] != negated)
+				list[nlist++] = c;
+		}
+	}
+};
+
+// Length of the prefix of s[0, n) inside a byteset
+inline size_t span_scalar(const byteset &b, const char *s, size_t n)
+{
+	size_t i = 0;
+	while (i < n && b.member[(uint8_t) s[i]])
+		i++;
+
+	return i;
+}
+
+#if NABU_SIMD_X86
+
+// Same as above, 16 bytes at a time
+__attribute__((target("sse2")))
+inline size_t span_sse2(const byteset &b, const char *s, size_t n)
+{
+	size_t i = 0;
+	if (b.nlist >= 0) {
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+			__m128i hit = _mm_setzero_si128();
+			for (int k = 0; k < b.nlist; k++) {
+				__m128i c = _mm_set1_epi8((char) b.list[k]);
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, c));
+			}
+
+			// Bits of the bytes outside the set
+			unsigned out = _mm_movemask_epi8(hit);
+			if (!b.negated)
+				out = ~out & 0xFFFFu;
+
+			if (out)
+				return i + __builtin_ctz(out);
+		}
+	}
+
+	return i + span_scalar(b, s + i, n - i);
+}
+
+// Same as above, 32 bytes at a time
+__attribute__((target("avx2")))
+inline size_t span_avx2(const byteset &b, const char *s, size_t n)
+{
+	size_t i = 0;
+	if (b.nlist >= 0) {
+		for (; i + 32 <= n; i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+			__m256i hit = _mm256_setzero_si256();
+			for (int k = 0; k < b.nlist; k++) {
+				__m256i c = _mm256_set1_epi8((char) b.list[k]);
+				hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, c));
+			}
+
+			unsigned out = _mm256_movemask_epi8(hit);
+			if (!b.negated)
+				out = ~out;
+
+			if (out)
+				return i + __builtin_ctz(out);
+		}
+	}
+
+	return i + span_scalar(b, s + i, n - i);
+}
+
+#endif
+
+using span_fn = size_t (*)(const byteset &, const char *, size_t);
+
+// Widest span function supported by the running CPU
+inline span_fn span_impl()
+{
+	static const span_fn fn = []() -> span_fn {
+
+#if NABU_SIMD_X86
+
+		if (__builtin_cpu_supports("avx2"))
+			return span_avx2;
+
+		if (__builtin_cpu_supports("sse2"))
+			return span_sse2;
+
+#endif
+
+		return span_scalar;
+	}();
+
+	return fn;
+}
+
+// Matches tokens decided by their first byte without going through
+// 	the automaton: single byte tokens (the byte leads to a state
+// 	which dies on everything) through a byte table, and ignored
+// 	tokens which are plain runs of bytes (whitespace, line comments,
+// 	...) where the byte leads to a state which loops on a set of
+// 	bytes and dies on all others, so the longest match is the run
+// 	(unless it spells a keyword, which is looked up as the automaton
+// 	does)
+struct prefilter {
+	int16_t			single[256];
+	int16_t			lead[256];
+	std::vector <byteset>	runs;
+	std::vector <int>	tokens;
+	const keywords		*kw = nullptr;
+	span_fn			span = span_impl();
+
+	prefilter() {
+		std::fill(single, single + 256, -1);
+		std::fill(lead, lead + 256, -1);
+	}
+
+	// ignored[i] tells whether the i-th regex is an ignored token
+	prefilter(const tables &a, const std::vector <bool> &ignored) : prefilter() {
+		kw = a.kw;
+
+		std::map <int, int> found;
+		for (int c = 0; c < 256; c++) {
+			int t = a.table[a.start * a.nclasses + a.classes[c]];
+			if (t < 0 || a.accept[t] < 0)
+				continue;
+
+			bool dead = true;
+			for (int k = 0; k < a.nclasses && dead; k++)
+				dead = (a.table[t * a.nclasses + k] < 0);
+
+			if (dead) {
+				single[c] = a.accept[t];
+				continue;
+			}
+
+			if (!ignored[a.accept[t]])
+				continue;
+
+			auto it = found.find(t);
+			if (it == found.end()) {
+				byteset b;
+
+				bool plain = true;
+				for (int d = 0; d < 256 && plain; d++) {
+					int u = a.table[t * a.nclasses + a.classes[d]];
+					plain = (u == t || u < 0);
+					b.member[d] = (u == t);
+				}
+
+				b.finish();
+
+				int r = plain ? runs.size() : -1;
+				if (plain) {
+					runs.push_back(b);
+					tokens.push_back(a.accept[t]);
+				}
+
+				it = found.insert({t, r}).first;
+			}
+
+			lead[c] = it->second;
+		}
+	}
+
+	// Length of the token at the start of s[0, n) if it is decided by
+	// 	its first byte (0 otherwise), alive is set if an ignored run
+	// 	reaches the end of the input
+	size_t match(const char *s, size_t n, int &index, bool &alive) const {
+		size_t read;
+		return match(s, n, index, alive, read);
+	}
+
+	// Same as above, also sets the number of bytes the result depends
+	// 	on (if there is one)
+	size_t match(const char *s, size_t n, int &index, bool &alive, size_t &read) const {
+		alive = false;
+
+		int b = single[(uint8_t) s[0]];
+		if (b >= 0) {
+			index = b;
+			read = 1;
+			return 1;
+		}
+
+		int r = lead[(uint8_t) s[0]];
+		if (r < 0)
+			return 0;
+
+		size_t len = 1 + span(runs[r], s + 1, n - 1);
+		index = tokens[r];
+		alive = (len == n);
+		read = alive ? n : len + 1;
+
+		if (kw) {
+			int w = kw->find(s, len);
+			if (w >= 0 && w < index)
+				index = w;
+		}
+
+		return len;
+	}
+
+	size_t match(const char *s, size_t n, int &index) const {
+		bool alive;
+		return match(s, n, index, alive);
+	}
+};
+
+// Read-only view of a whole file, memory-mapped where possible
+class mapped_file {
+	const char	*_data = nullptr;
+	size_t		_size = 0;
+
+#if NABU_POSIX
+
+	void		*_map = nullptr;
+
+#else
+
+	std::string	_buffer;
+
+#endif
+
+public:
+	mapped_file() {}
+
+	// No copy constructor
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	~mapped_file() {
+		close();
+	}
+
+	bool open(const char *path) {
+		close();
+
+#if NABU_POSIX
+
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+
+		void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (map == MAP_FAILED)
+			return false;
+
+		_map = map;
+		_data = (const char *) map;
+		_size = st.st_size;
+
+#else
+
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return false;
+
+		_buffer.assign(std::istreambuf_iterator <char> (in),
+			std::istreambuf_iterator <char> ());
+
+		_data = _buffer.data();
+		_size = _buffer.size();
+
+#endif
+
+		return true;
+	}
+
+	void close() {
+
+#if NABU_POSIX
+
+		if (_map)
+			munmap(_map, _size);
+
+		_map = nullptr;
+
+#else
+
+		_buffer.clear();
+
+#endif
+
+		_data = nullptr;
+		_size = 0;
+	}
+
+	const char *data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+};
+
+// Automaton stored in a file (in native byte order): the header, the
+// 	classes, the transitions and accepts as int32, then each keyword
+// 	as its index, its length and its bytes padded to 4
+struct image_header {
+	char		magic[8];
+	uint64_t	fingerprint;
+	int32_t		nclasses;
+	int32_t		start;
+	int32_t		nstates;
+	int32_t		nkeywords;
+	uint32_t	size;
+	uint32_t	reserved;
+};
+
+static constexpr char image_magic[8] = {'n', 'a', 'b', 'u', 'd', 'f', 'a', '1'};
+
+// Writes the image of an automaton, through a temporary file which is
+// 	renamed over path so readers never see a partial image
+inline bool save(const automaton &a, uint64_t fingerprint, const std::string &path)
+{
+	static_assert(sizeof(int) == sizeof(int32_t), "nabu: int must be 32 bits");
+
+	int32_t nstates = a.accept.size();
+
+	std::string body((const char *) a.classes, 256);
+	body.append((const char *) a.table.data(), a.table.size() * sizeof(int32_t));
+	body.append((const char *) a.accept.data(), a.accept.size() * sizeof(int32_t));
+
+	for (size_t w = 0; w < a.kw.words.size(); w++) {
+		int32_t head[2] = {a.kw.indices[w], (int32_t) a.kw.words[w].size()};
+		body.append((const char *) head, sizeof(head));
+		body.append(a.kw.words[w]);
+		body.append((4 - body.size() % 4) % 4, '\0');
+	}
+
+	image_header h;
+	memcpy(h.magic, image_magic, 8);
+	h.fingerprint = fingerprint;
+	h.nclasses = a.nclasses;
+	h.start = a.start;
+	h.nstates = nstates;
+	h.nkeywords = a.kw.words.size();
+	h.size = sizeof(h) + body.size();
+	h.reserved = 0;
+
+	// Unique per writer, several processes may compile at once
+	std::string tmp = path + "." + std::to_string(std::random_device()()) + ".tmp";
+
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out.write((const char *) &h, sizeof(h));
+		out.write(body.data(), body.size());
+		if (!out)
+			return false;
+	}
+
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Tables in a mapped image of an automaton for ntokens regexes, the
+// 	keywords are rebuilt into kw; false if the image is for other
+// 	regexes or is damaged
+inline bool load(const mapped_file &file, uint64_t fingerprint, int ntokens,
+		tables &t, keywords &kw)
+{
+	const char *p = file.data();
+	size_t size = file.size();
+
+	image_header h;
+	if (size < sizeof(h))
+		return false;
+
+	memcpy(&h, p, sizeof(h));
+	if (memcmp(h.magic, image_magic, 8) || h.fingerprint != fingerprint
+			|| h.size != size || h.nclasses < 1 || h.nclasses > 256
+			|| h.nstates < 1 || h.start < 0 || h.start >= h.nstates)
+		return false;
+
+	size_t cells = (size_t) h.nstates * h.nclasses;
+	size_t off = sizeof(h) + 256 + (cells + h.nstates) * sizeof(int32_t);
+	if (off > size)
+		return false;
+
+	const uint8_t *classes = (const uint8_t *) (p + sizeof(h));
+	const int *table = (const int *) (p + sizeof(h) + 256);
+	const int *accept = table + cells;
+
+	// Everything is checked, a damaged image must not be followed
+	for (int c = 0; c < 256; c++) {
+		if (classes[c] >= h.nclasses)
+			return false;
+	}
+
+	for (size_t k = 0; k < cells; k++) {
+		if (table[k] < -1 || table[k] >= h.nstates)
+			return false;
+	}
+
+	for (int s = 0; s < h.nstates; s++) {
+		if (accept[s] < -1 || accept[s] >= ntokens)
+			return false;
+	}
+
+	if (h.nkeywords < 0 || h.nkeywords > ntokens)
+		return false;
+
+	keywords words;
+	for (int w = 0; w < h.nkeywords; w++) {
+		int32_t head[2];
+		if (off + sizeof(head) > size)
+			return false;
+
+		memcpy(head, p + off, sizeof(head));
+		off += sizeof(head);
+		if (head[0] < 0 || head[0] >= ntokens || head[1] < 2
+				|| off + head[1] > size)
+			return false;
+
+		words.add(std::string(p + off, head[1]), head[0]);
+		off += head[1] + (4 - head[1] % 4) % 4;
+	}
+
+	if (off != size || !words.finish())
+		return false;
+
+	kw = words;
+	t = {classes, h.nclasses, h.start, table, accept,
+		kw.empty() ? nullptr : &kw};
+
+	return true;
+}
+
+}
+
+// Add the regexes of a lexlist to the DFA builder, a regex the DFA does
+// 	not support is an error unless strict is off (false is returned)
+template <class T>
+bool dfa_add(dfa::builder &b, bool strict = true)
+{
+	const char *error = nullptr;
+	size_t epos = 0;
+
+	if (!b.add(token <T> ::regex, error, epos)) {
+		if (!strict)
+			return false;
+
+		std::string id = "(id: " + std::to_string(token <T> ::id) + ")";
+
+#ifdef NABU_DEBUG_PARSER
+
+		id = "(name: " + std::string(token <T> ::name) + ")";
+
+#endif
+
+		std::cerr << "[nabu] Error compiling regex " << id << ":\n";
+		std::cerr << "\t" << error << " at position " << epos << std::endl;
+		std::cerr << "\tregex: \"" << token <T> ::regex << "\"" << std::endl;
+
+		exit(1);
+	}
+
+	if constexpr (!lexlist <T> ::tail)
+		return dfa_add <typename lexlist <T> ::next> (b, strict);
+	else
+		return true;
+}
+
+// Compile the DFA for a set of lexical rules
+template <class Head>
+inline dfa::automaton compile_dfa()
+{
+	check_cyclic <Head> ();
+
+	dfa::builder b;
+	dfa_add <Head> (b);
+	return b.build();
+}
+
+// Collect the regexes of a lexlist at compile time
+template <class T>
+constexpr void static_regexes(const char **out)
+{
+	static_assert(dfa::static_check(token <T> ::regex),
+		"[nabu] invalid regex in lexlist (the note names the token)");
+
+	*out = token <T> ::regex;
+	if constexpr (!lexlist <T> ::tail)
+		static_regexes <typename lexlist <T> ::next> (out + 1);
+}
+
+template <class Head>
+constexpr dfa::static_result static_build()
+{
+	const char *regexes[_length <Head> ()] = {};
+	static_regexes <Head> (regexes);
+	return dfa::build_static(regexes, _length <Head> ());
+}
+
+// DFA for a set of lexical rules, built during compilation
+template <class Head>
+struct static_dfa {
+	static constexpr dfa::static_result result = static_build <Head> ();
+	static constexpr auto value = dfa::shrink
+		<result.nstates, result.nclasses> (result);
+};
+
+// Construct the lexicon for a token, the text of the token is borrowed
+// 	from str unless own is set
+template <class T, bool own>
+parser::lexicon emit_token(const char *str, size_t len, int line, int col, bool &ignored)
+{
+	// Alias to keep things clean
+	using Node = token <T>;
+
+	if (ignore <T> ::value)
+		ignored = true;
+
+	parser::lexicon lptr;
+	if (Node::overloaded) {
+
+#ifdef NABU_DEBUG_PARSER
+
+		lptr = parser::lexicon(new parser::lexvalue
+			<typename Node::cast_type> (
+				Node::cast(std::string(str, len)),
+				Node::id, Node::name, line, col
+			)
+		);
+
+#else
+
+		lptr = parser::lexicon(new parser::lexvalue
+			<typename Node::cast_type> (
+				Node::cast(std::string(str, len)),
+				Node::id, line, col
+			)
+		);
+
+#endif
+
+	} else if (own) {
+		// The token keeps a copy of its text
+
+#ifdef NABU_DEBUG_PARSER
+
+		lptr = parser::lexicon(
+			new parser::lexvalue <std::string> (
+				std::string(str, len),
+				Node::id, Node::name, line, col
+			)
+		);
+
+#else
+
+		lptr = parser::lexicon(
+			new parser::lexvalue <std::string> (
+				std::string(str, len),
+				Node::id, line, col
+			)
+		);
+
+#endif
+
+		lptr->text = *lptr->owned();
+		return lptr;
+	} else {
+
+#ifdef NABU_DEBUG_PARSER
+
+		lptr = parser::lexicon(
+			new parser::_lexvalue(
+				Node::id, Node::name, line, col
+			)
+		);
+
+#else
+
+		lptr = parser::lexicon(
+			new parser::_lexvalue(
+				Node::id, line, col
+			)
+		);
+
+#endif
+
+	}
+
+	if (!own)
+		lptr->text = std::string_view(str, len);
+
+	return lptr;
+}
+
+// Appends a token to a queue: ignored tokens are dropped, and only
+// 	tokens with values are constructed here
+template <class T>
+void push_one(parser::Queue &q, size_t offset, size_t len, line_cursor &lc)
+{
+	using Node = token <T>;
+
+	if (ignore <T> ::value)
+		return;
+
+#ifdef NABU_DEBUG_PARSER
+
+	// Debug lexicons carry the name of the token
+	constexpr bool eager = true;
+
+#else
+
+	constexpr bool eager = Node::overloaded;
+
+#endif
+
+	uint32_t sym = symbol_table::none;
+	if constexpr (intern <T> ::value) {
+		if (!q.symbols)
+			q.symbols = std::make_shared <symbol_table> ();
+
+		sym = q.symbols->add(std::string_view(q.source->data() + offset, len));
+	}
+
+	if (eager) {
+		auto loc = lc.locate(offset);
+
+		bool ignored = false;
+		parser::lexicon lptr = emit_token <T, false> (q.source->data() + offset,
+			len, loc.first, loc.second, ignored);
+
+		lptr->symbol = sym;
+		q.push(offset, len, lptr);
+	} else {
+		q.push(Node::id, offset, len, sym);
+	}
+}
+
+// Description of a token, for lexer statistics
+struct token_info {
+	int		id;
+	const char	*regex;
+	const char	*name;
+	bool		ignored;
+};
+
+template <class T>
+constexpr token_info info_of()
+{
+
+#ifdef NABU_DEBUG_PARSER
+
+	return {token <T> ::id, token <T> ::regex, token <T> ::name, ignore <T> ::value};
+
+#else
+
+	return {token <T> ::id, token <T> ::regex, "", ignore <T> ::value};
+
+#endif
+
+}
+
+// Functions of the tokens of a lexlist, indexed by their position, so a
+// 	match is handled with one indirect call instead of a walk down the
+// 	list
+template <class Head, class I = std::make_index_sequence <_length <Head> ()>>
+struct token_table;
+
+template <class Head, size_t ... I>
+struct token_table <Head, std::index_sequence <I...>> {
+	using push_fn = void (*)(parser::Queue &, size_t, size_t, line_cursor &);
+	using emit_fn = parser::lexicon (*)(const char *, size_t, int, int, bool &);
+
+	static constexpr size_t size = sizeof...(I);
+
+	static constexpr push_fn push[] = {
+		&push_one <typename lexlist_at <Head, I> ::type>...
+	};
+
+	static constexpr emit_fn emit[] = {
+		&emit_token <typename lexlist_at <Head, I> ::type, false>...
+	};
+
+	static constexpr emit_fn emit_owned[] = {
+		&emit_token <typename lexlist_at <Head, I> ::type, true>...
+	};
+
+	static constexpr token_info info[] = {
+		info_of <typename lexlist_at <Head, I> ::type> ()...
+	};
+};
+
+// Name of the token of a lexlist with an id
+template <class Head>
+const char *token_name(int id)
+{
+	using table = token_table <Head>;
+	for (const token_info &info : table::info) {
+		if (info.id == id)
+			return info.name;
+	}
+
+	return (id == token <lexerror> ::id) ? "lexerror" : "?";
+}
+
+// Lets the debug lexicons of a queue lexed with a lexlist carry
+// 	the names of their tokens
+template <class Head>
+void name_tokens([[maybe_unused]] parser::Queue &q)
+{
+
+#ifdef NABU_DEBUG_PARSER
+
+	q.names = &token_name <Head>;
+
+#endif
+
+}
+
+// Construct the lexicon for the index-th token of a lexlist, the
+// 	text of the token is borrowed from str unless own is set
+template <class Head, bool own = false>
+parser::lexicon emit(int index, const char *str, size_t len, int line, int col, bool &ignored)
+{
+	using table = token_table <Head>;
+	if (index < 0 || (size_t) index >= table::size)
+		return nullptr;
+
+	if constexpr (own)
+		return table::emit_owned[index](str, len, line, col, ignored);
+	else
+		return table::emit[index](str, len, line, col, ignored);
+}
+
+// Appends the index-th token of a lexlist to a queue
+template <class Head>
+void push_token(parser::Queue &q, int index, size_t offset, size_t len, line_cursor &lc)
+{
+	using table = token_table <Head>;
+	if (index >= 0 && (size_t) index < table::size)
+		table::push[index](q, offset, len, lc);
+}
+
+// Default error for lexing
+[[noreturn]]
+inline void error(const std::string &str, const line_index &lines, int line, int col)
+{
+	std::string line_str = lines.text(line);
+	// std::cout << "[nabu] Error: \"" << line_str << "\"" << std::endl;
+	printf("%s[nabu-lexq]%s error: read bad lexicon \"%s\" at line %d, column %d\n",
+		NABU_ERROR_COLOR, NABU_RESET_COLOR,
+		str.c_str(), line, col);
+	printf(" %5d | %s%s%s\n", line,
+		NABU_ERROR_COLOR, line_str.c_str(),
+		NABU_RESET_COLOR);
+	std::string space(col - 1, ' ');
+	std::string squiggle(std::max((int) line_str.size() - col, 0), '~');
+	printf(" %5c | %s%s^%s%s\n", ' ',
+		NABU_ERROR_COLOR, space.c_str(),
+		squiggle.c_str(), NABU_RESET_COLOR);
+	exit(1);
+}
+
+// Split a string without spaces
+inline std::vector <std::string> split(const std::string &str)
+{
+	std::vector <std::string> ret;
+
+	std::string curr;
+	std::string content = str + '\n';
+	for (int i = 0; i < content.length(); i++) {
+		char c = content[i];
+		if (isspace(c)) {
+			if (curr.length() > 0) {
+				ret.push_back(curr);
+				curr.clear();
+			}
+		} else {
+			curr += c;
+		}
+	}
+
+	return ret;
+}
+
+// Lexer error handler
+// TODO: docs -> specialize to overload the handling
+template <class Head>
+void lerror_handler(const std::string &err, const line_index &lines, int line, int col)
+{
+	error(err, lines, line, col);
+}
+
+// Lexer error, recorded instead of calling lerror_handler when lexing
+// 	recovers from errors
+struct diagnostic {
+	std::string	text;
+	int		line;
+	int		col;
+};
+
+// Errors of one lexing pass, at most cap of them are kept
+struct diagnostics {
+	std::vector <diagnostic>	list;
+	size_t				cap;
+
+	// All errors, including the ones past the cap
+	size_t				count = 0;
+
+	diagnostics(size_t cap_ = 64) : cap(cap_) {}
+
+	void add(const std::string &text, int line, int col) {
+		if (list.size() < cap)
+			list.push_back({text, line, col});
+
+		count++;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	void clear() {
+		list.clear();
+		count = 0;
+	}
+};
+
+// Counters of lexing passes, added to by lexq when given; how the time
+// 	splits between matching and queueing is estimated from every
+// 	sample-th match, so keeping the counters on costs about a branch
+// 	per token
+struct lexer_stats {
+	static constexpr size_t sample = 64;
+
+	// Counters of a token id
+	struct entry {
+		const token_info	*info = nullptr;
+		size_t			matches = 0;
+		size_t			bytes = 0;
+	};
+
+	// Indexed by token id
+	std::vector <entry>	tokens;
+
+	// Source bytes scanned, and those no token matched
+	size_t			bytes = 0;
+	size_t			skipped = 0;
+
+	// Tokens matched, of which ignored, and tokens queued
+	size_t			matches = 0;
+	size_t			ignored = 0;
+	size_t			queued = 0;
+
+	// Whole passes, running the automata and queueing tokens
+	// 	(constructing the lexicons of those with values)
+	double			seconds = 0;
+	double			match_seconds = 0;
+	double			push_seconds = 0;
+
+	// Largest queue storage in bytes (lexicons are estimated)
+	size_t			peak_memory = 0;
+
+	void count(const token_info &t, size_t len) {
+		if (t.id >= 0) {
+			if ((size_t) t.id >= tokens.size())
+				tokens.resize(t.id + 1);
+
+			entry &e = tokens[t.id];
+			e.info = &t;
+			e.matches++;
+			e.bytes += len;
+		}
+
+		matches++;
+		ignored += t.ignored;
+	}
+
+	void clear() {
+		*this = lexer_stats();
+	}
+
+	// JSON object of the counters, tokens by descending matches
+	std::string json() const {
+		auto quote = [](const char *str) {
+			std::string out = "\"";
+			for (const char *c = str; *c; c++) {
+				if (*c == '"' || *c == '\\') {
+					out += '\\';
+					out += *c;
+				} else if ((unsigned char) *c < 0x20) {
+					char hex[8];
+					snprintf(hex, sizeof(hex), "\\u%04x", *c);
+					out += hex;
+				} else {
+					out += *c;
+				}
+			}
+
+			return out + "\"";
+		};
+
+		std::vector <int> ids;
+		for (size_t i = 0; i < tokens.size(); i++) {
+			if (tokens[i].matches)
+				ids.push_back(i);
+		}
+
+		std::stable_sort(ids.begin(), ids.end(), [&](int a, int b) {
+			return tokens[a].matches > tokens[b].matches;
+		});
+
+		std::ostringstream out;
+		out << "{\n"
+			<< "\t\"bytes\": " << bytes << ",\n"
+			<< "\t\"skipped\": " << skipped << ",\n"
+			<< "\t\"matches\": " << matches << ",\n"
+			<< "\t\"ignored\": " << ignored << ",\n"
+			<< "\t\"queued\": " << queued << ",\n"
+			<< "\t\"seconds\": " << seconds << ",\n"
+			<< "\t\"match_seconds\": " << match_seconds << ",\n"
+			<< "\t\"push_seconds\": " << push_seconds << ",\n"
+			<< "\t\"bytes_per_second\": "
+			<< (seconds > 0 ? bytes / seconds : 0) << ",\n"
+			<< "\t\"peak_memory\": " << peak_memory << ",\n"
+			<< "\t\"tokens\": [";
+
+		for (size_t i = 0; i < ids.size(); i++) {
+			const entry &e = tokens[ids[i]];
+			out << (i ? ",\n" : "\n")
+				<< "\t\t{\"id\": " << ids[i]
+				<< ", \"name\": " << quote(e.info->name)
+				<< ", \"regex\": " << quote(e.info->regex)
+				<< ", \"ignored\": " << (e.info->ignored ? "true" : "false")
+				<< ", \"matches\": " << e.matches
+				<< ", \"bytes\": " << e.bytes << "}";
+		}
+
+		out << (ids.empty() ? "]\n}" : "\n\t]\n}");
+		return out.str();
+	}
+};
+
+// Splits the time of a lexing loop between matching and queueing by
+// 	timing every lexer_stats::sample-th match, nothing is done
+// 	without stats
+class stats_sampler {
+	using clock = std::chrono::steady_clock;
+
+	lexer_stats		*_stats;
+	size_t			_n = 0;
+	bool			_on = false;
+	clock::time_point	_begin;
+	clock::time_point	_start;
+
+	// Sampled times
+	double			_match = 0;
+	double			_push = 0;
+
+	static double since(clock::time_point t) {
+		return std::chrono::duration <double> (clock::now() - t).count();
+	}
+public:
+	stats_sampler(lexer_stats *stats) : _stats(stats) {
+		if (_stats)
+			_begin = clock::now();
+	}
+
+	~stats_sampler() {
+		double sampled = _match + _push;
+		if (!_stats || sampled <= 0)
+			return;
+
+		double total = since(_begin);
+		_stats->match_seconds += total * _match / sampled;
+		_stats->push_seconds += total * _push / sampled;
+	}
+
+	// Before a match is attempted
+	void start() {
+		if (_stats && (_on = (_n++ % lexer_stats::sample == 0)))
+			_start = clock::now();
+	}
+
+	// After the match, before it is queued
+	void matched() {
+		if (_on) {
+			_match += since(_start);
+			_start = clock::now();
+		}
+	}
+
+	void pushed(const token_info &t, size_t len) {
+		if (!_stats)
+			return;
+
+		_stats->count(t, len);
+		if (_on)
+			_push += since(_start);
+	}
+
+	// After an attempt which matched nothing
+	void skipped() {
+		if (!_stats)
+			return;
+
+		_stats->skipped++;
+		if (_on)
+			_match += since(_start);
+	}
+};
+
+// Queues a lexerror token over source[offset, offset + len)
+inline void push_error(parser::Queue &q, size_t offset, size_t len,
+		[[maybe_unused]] int line, [[maybe_unused]] int col)
+{
+
+#ifdef NABU_DEBUG_PARSER
+
+	parser::lexicon lptr(new parser::_lexvalue(
+		token <lexerror> ::id, token <lexerror> ::name, line, col
+	));
+
+	lptr->text = std::string_view(q.source->data() + offset, len);
+	q.push(offset, len, lptr);
+
+#else
+
+	q.push(token <lexerror> ::id, offset, len);
+
+#endif
+
+}
+
+// End of the previous match while lexing, there is none at the start
+struct match_end {
+	size_t	offset = 0;
+	bool	valid = false;
+
+	match_end() {}
+	match_end(size_t end) : offset(end), valid(true) {}
+
+	// Start of the unmatched text before pos, false if there is none
+	// 	to report (a single byte after a match never is)
+	bool gap(size_t pos, size_t &start) const {
+		if (valid ? pos <= offset + 1 : pos == 0)
+			return false;
+
+		start = valid ? offset : 0;
+		return true;
+	}
+};
+
+// Report unmatched text between the end of the previous match and pos
+template <class Head>
+void check_gap(const std::string &source, match_end prev, size_t pos,
+		const line_index &lines)
+{
+	size_t start;
+	if (!prev.gap(pos, start))
+		return;
+
+	std::string s = source.substr(start, pos - start);
+	std::vector <std::string> sp = split(s);
+
+	if (sp.size() > 0) {
+		auto loc = lines.locate(start);
+		lerror_handler <Head> (sp[0], lines, loc.first, loc.second + 1);
+	}
+}
+
+// Whether check_gap reports the text between prev and pos
+inline bool has_gap(const std::string &source, match_end prev, size_t pos)
+{
+	size_t start;
+	return prev.gap(pos, start) && !split(source.substr(start, pos - start)).empty();
+}
+
+// Same as above, but with diag the text is queued as a lexerror token
+// 	and recorded, and lexing goes on
+template <class Head>
+void check_gap(const std::string &source, match_end prev, size_t pos,
+		const line_index &lines, parser::Queue &q, diagnostics *diag)
+{
+	if (!diag) {
+		check_gap <Head> (source, prev, pos, lines);
+		return;
+	}
+
+	size_t start;
+	if (!prev.gap(pos, start))
+		return;
+
+	std::string s = source.substr(start, pos - start);
+	std::vector <std::string> sp = split(s);
+
+	if (sp.size() > 0) {
+		auto loc = lines.locate(start);
+		diag->add(sp[0], loc.first, loc.second + 1);
+		push_error(q, start, pos - start, loc.first, loc.second);
+	}
+}
+
+// File caching the runtime automaton of a lexlist between runs, none
+// 	unless declared with lexer_cache_file
+template <class Head>
+struct lexer_cache_file {
+	static constexpr const char *value = nullptr;
+};
+
+#define lexer_cache_file(Head, path)				\
+	template <>						\
+	struct nabu::parser::lexer_cache_file <Head> {		\
+		static constexpr const char *value = path;	\
+	};
+
+// Hash of the regexes of a lexlist, which identifies its cache images
+template <class T>
+void dfa_fingerprint(uint64_t &h)
+{
+	const char *s = token <T> ::regex;
+	do {
+		h ^= (uint8_t) *s;
+		h *= 1099511628211ull;
+	} while (*s++);
+
+	if constexpr (!lexlist <T> ::tail)
+		dfa_fingerprint <typename lexlist <T> ::next> (h);
+}
+
+template <class Head>
+uint64_t dfa_fingerprint()
+{
+	uint64_t h = 14695981039346656037ull;
+	dfa_fingerprint <Head> (h);
+	return h;
+}
+
+// Rule tokens of a lexlist, by the bytes they may start with: a rule
+// 	may start with a byte if, run on that byte alone, it matches or
+// 	reads past it
+struct rule_dispatch {
+	using match_fn = size_t (*)(const char *, size_t, size_t &);
+
+	struct entry {
+		int		index;
+		match_fn	match;
+	};
+
+	std::vector <entry>	entries;
+	std::vector <uint16_t>	first[256];
+
+	void add(int index, match_fn fn) {
+		uint16_t k = entries.size();
+		entries.push_back({index, fn});
+
+		for (int b = 0; b < 256; b++) {
+			char c = b;
+			size_t read;
+
+			if (fn(&c, 1, read) > 0 || read > 1)
+				first[b].push_back(k);
+		}
+	}
+
+	// Longest of the rule matches at s and a DFA match of len bytes
+	// 	(ties go to the earlier token), updating what the DFA read
+	size_t match(const char *s, size_t n, size_t len, int &index,
+			bool &alive, size_t &read) const {
+		for (uint16_t k : first[(uint8_t) *s]) {
+			const entry &e = entries[k];
+
+			size_t r;
+			size_t l = e.match(s, n, r);
+
+			alive |= (r > n);
+			read = std::max(read, std::min(r, n));
+
+			if (l > len || (l == len && l > 0 && e.index < index)) {
+				len = l;
+				index = e.index;
+			}
+		}
+
+		return len;
+	}
+
+	// Rule of the index-th token, if it has one
+	match_fn find(int index) const {
+		for (const entry &e : entries) {
+			if (e.index == index)
+				return e.match;
+		}
+
+		return nullptr;
+	}
+
+	template <class Head>
+	static const rule_dispatch &get();
+};
+
+template <class T>
+void rule_entries(rule_dispatch &d, int index)
+{
+	if constexpr (lexer_rule <T> ::value)
+		d.add(index, &lexer_rule <T> ::match);
+
+	if constexpr (!lexlist <T> ::tail)
+		rule_entries <typename lexlist <T> ::next> (d, index + 1);
+}
+
+template <class Head>
+const rule_dispatch &rule_dispatch::get()
+{
+	static const rule_dispatch dispatch = []() {
+		rule_dispatch d;
+		rule_entries <Head> (d, 0);
+		return d;
+	}();
+
+	return dispatch;
+}
+
+// Rule tokens of a lexlist, if it has any
+template <class Head>
+const rule_dispatch *rules_of()
+{
+	if constexpr (has_rules <Head> ())
+		return &rule_dispatch::get <Head> ();
+	else
+		return nullptr;
+}
+
+// Longest token at the start of s[0, n): the prefilter, then the DFA,
+// 	then any rule tokens
+inline size_t lex_match(const dfa::tables &a, const dfa::prefilter &filter,
+		const rule_dispatch *rules, const char *s, size_t n,
+		int &index, bool &alive, size_t &read)
+{
+	size_t len = filter.match(s, n, index, alive, read);
+	if (len == 0)
+		len = a.match(s, n, index, alive, read);
+
+	if (rules)
+		len = rules->match(s, n, len, index, alive, read);
+
+	return len;
+}
+
+// DFA of a lexlist and what the lexers derive from it, set up once per
+// 	lexlist and shared read-only by all lexers (and threads): the
+// 	compile-time tables with static_engine, otherwise the runtime
+// 	automaton, mapped from its cache file when that is up to date
+template <class Head>
+class dfa_lexer {
+	dfa::automaton		_storage;
+	dfa::mapped_file	_file;
+	dfa::keywords		_kw;
+
+	dfa_lexer() {
+		check_cyclic <Head> ();
+
+		using engine = typename lexer_engine <Head> ::type;
+		if constexpr (std::is_same_v <engine, static_engine>) {
+			tables = static_dfa <Head> ::value.view();
+		} else {
+			const char *path = lexer_cache_file <Head> ::value;
+			uint64_t fingerprint = dfa_fingerprint <Head> ();
+
+			bool cached = path && _file.open(path)
+				&& dfa::load(_file, fingerprint, _length <Head> (),
+					tables, _kw);
+
+			if (!cached) {
+				_file.close();
+				_storage = compile_dfa <Head> ();
+				tables = _storage.view();
+
+				// Best effort, the next run compiles again on failure
+				if (path)
+					dfa::save(_storage, fingerprint, path);
+			}
+		}
+
+		ignored = ignored_tokens <Head> ();
+		filter = dfa::prefilter(tables, ignored);
+	}
+public:
+	dfa::tables		tables;
+	dfa::prefilter		filter;
+	std::vector <bool>	ignored;
+
+	// No copy constructor (the tables point into this)
+	dfa_lexer(const dfa_lexer &) = delete;
+	dfa_lexer &operator=(const dfa_lexer &) = delete;
+
+	static const dfa_lexer &get() {
+		static const dfa_lexer lexer;
+		return lexer;
+	}
+};
+
+// A lexlist as a lexer mode: its automaton, the lexing functions of its
+// 	tokens and the mode switch after each of them
+struct lexer_mode {
+	const dfa::tables		*tables;
+	const dfa::prefilter		*filter;
+	const std::vector <bool>	*ignored;
+	const rule_dispatch		*rules;
+	std::vector <bool>		interned;
+
+	// Mode to push after each token (if action is 1), modes are set up
+	// 	on first use since they may refer to each other
+	std::vector <int>				action;
+	std::vector <const lexer_mode *(*)()>		target;
+
+	void (*push)(Queue &, int, size_t, size_t, line_cursor &);
+	void (*gap)(const std::string &, match_end, size_t, const line_index &,
+		Queue &, diagnostics *);
+	lexicon (*emit)(int, const char *, size_t, int, int, bool &);
+	void (*error)(const std::string &, const line_index &, int, int);
+
+	// Tokens by index
+	const token_info		*info;
+
+	template <class Head>
+	static const lexer_mode *get();
+};
+
+template <class T>
+void mode_actions(lexer_mode &m)
+{
+	using Action = lexer_action <T>;
+
+	m.action.push_back(Action::value);
+	if constexpr (Action::value > 0)
+		m.target.push_back(&lexer_mode::get <typename Action::mode>);
+	else
+		m.target.push_back(nullptr);
+
+	if constexpr (!lexlist <T> ::tail)
+		mode_actions <typename lexlist <T> ::next> (m);
+}
+
+template <class Head>
+const lexer_mode *lexer_mode::get()
+{
+	static const lexer_mode mode = []() {
+		const auto &lexer = dfa_lexer <Head> ::get();
+
+		lexer_mode m;
+		m.tables = &lexer.tables;
+		m.filter = &lexer.filter;
+		m.ignored = &lexer.ignored;
+		m.rules = rules_of <Head> ();
+		m.push = &push_token <Head>;
+		m.gap = &check_gap <Head>;
+		m.emit = &parser::emit <Head, true>;
+		m.error = &lerror_handler <Head>;
+		m.info = token_table <Head> ::info;
+
+		mode_actions <Head> (m);
+		interned_tokens <Head> (m.interned);
+		return m;
+	}();
+
+	return &mode;
+}
+
+// Applies the mode switch of the index-th token of the current mode,
+// 	popping the outermost mode does nothing
+inline void switch_mode(std::vector <const lexer_mode *> &modes, int index)
+{
+	const lexer_mode &m = *modes.back();
+	if (m.action[index] > 0)
+		modes.push_back(m.target[index]());
+	else if (m.action[index] < 0 && modes.size() > 1)
+		modes.pop_back();
+}
+
+// Lexes q's source from pos into q until stop(pos) holds, prev is the
+// 	end of the previous match and reach the end of the source read so
+// 	far; returns where it stopped
+template <class Head, bool ignore_error, class Stop>
+size_t lex_dfa(Queue &q, size_t pos, match_end &prev, size_t &reach, line_cursor &lc,
+		const dfa::tables &a, const dfa::prefilter &filter,
+		diagnostics *diag, lexer_stats *stats, Stop stop)
+{
+	const std::string &source = *q.source;
+
+	const rule_dispatch *rules = rules_of <Head> ();
+
+	stats_sampler sampler(stats);
+
+	const char *s = source.data();
+	size_t n = source.size();
+	while (pos < n && !stop(pos)) {
+		int index;
+		bool alive;
+		size_t read;
+
+		sampler.start();
+
+		size_t len = lex_match(a, filter, rules, s + pos, n - pos,
+			index, alive, read);
+
+		// More input would have been read past the end
+		reach = std::max(reach, alive ? std::string::npos : pos + read);
+		q.mark(reach);
+
+		// Unmatched bytes are checked as gaps by the next match
+		if (len == 0) {
+			sampler.skipped();
+			pos++;
+			continue;
+		}
+
+		sampler.matched();
+
+		if (!ignore_error)
+			check_gap <Head> (source, prev, pos, lc.index(), q, diag);
+
+		push_token <Head> (q, index, pos, len, lc);
+		sampler.pushed(token_table <Head> ::info[index], len);
+
+		// Update the previous position
+		pos += len;
+		prev = pos;
+	}
+
+	return pos;
+}
+
+// Lexes a string with the tables of a built-in DFA, errors are recorded
+// 	in diag (if given) instead of being reported
+template <class Head, bool ignore_error = false>
+Queue lexq_dfa(std::shared_ptr <const std::string> buffer, const dfa::tables &a,
+		const dfa::prefilter &filter, diagnostics *diag = nullptr,
+		lexer_stats *stats = nullptr)
+{
+	const std::string &source = *buffer;
+
+	Queue q;
+	q.source = buffer;
+	q.lines = line_index(source);
+	name_tokens <Head> (q);
+
+	line_cursor lc(q.lines);
+
+	// Store previous index
+	match_end prev;
+	size_t reach = 0;
+
+	lex_dfa <Head, ignore_error> (q, 0, prev, reach, lc, a, filter, diag,
+		stats, [](size_t) { return false; });
+
+	return q;
+}
+
+template <class Head, bool ignore_error = false>
+Queue lexq_dfa(std::shared_ptr <const std::string> buffer, const dfa::tables &a,
+		diagnostics *diag = nullptr)
+{
+	dfa::prefilter filter(a, ignored_tokens <Head> ());
+	return lexq_dfa <Head, ignore_error> (buffer, a, filter, diag);
+}
+
+// DFA of the regexes of a std_engine lexlist, which tells which token
+// 	std::regex matched; none if a regex is not supported by the DFA
+template <class Head>
+struct std_resolver {
+	dfa::automaton	automaton;
+	bool		valid = false;
+
+	static const std_resolver &get() {
+		static const std_resolver resolver = []() {
+			std_resolver r;
+
+			dfa::builder b;
+			if (dfa_add <Head> (b, false)) {
+				r.automaton = b.build();
+				r.valid = true;
+			}
+
+			return r;
+		}();
+
+		return resolver;
+	}
+};
+
+// Index of the token whose capture group matched, or -1: with the first
+// 	alternative winning, no earlier token accepts the matched text, so
+// 	the DFA accepts it with that token; the group is only checked, and
+// 	the groups are scanned in order when the DFA cannot tell
+template <class Head>
+int match_index(const std::sregex_iterator &it)
+{
+	const std::smatch &m = *it;
+
+	size_t n = std::min(m.size(), (size_t) _length <Head> () + 1);
+
+	const std_resolver <Head> &resolver = std_resolver <Head> ::get();
+	size_t len = m.length(0);
+	if (resolver.valid && len > 0) {
+		int index;
+		if (resolver.automaton.match(&*m[0].first, len, index) == len
+				&& index >= 0 && (size_t) index + 1 < n
+				&& m[index + 1].matched)
+			return index;
+	}
+
+	for (size_t i = 1; i < n; i++) {
+		if (m[i].matched && m[i].length() > 0)
+			return i - 1;
+	}
+
+	return -1;
+}
+
+// Lexes a string with std::regex, errors are recorded in diag (if
+// 	given) instead of being reported
+template <class Head, bool ignore_error = false>
+Queue lexq_std(std::shared_ptr <const std::string> buffer,
+		diagnostics *diag = nullptr, lexer_stats *stats = nullptr)
+{
+	const std::string &source = *buffer;
+
+	// Compiled (and checked) once per lexlist
+	static const std::regex re = []() {
+		std::regex re = compile <Head> ();
+
+#ifdef NABU_DEBUG_PARSER
+	
+		printf("%s[nabu-lexq]%s successfully compiled regex: \"%s\"\n",
+			NABU_OK_COLOR, NABU_RESET_COLOR,
+			concat <Head> ().c_str());
+
+		// The idea is to use the regex on a string
+		// 	with all possible characters, so that
+		// 	at least one of them will match
+		std::string _str = "";
+		for (int c = 32; c < 255; c++) {
+			if (isprint(c))
+				_str += (char) c;
+		}
+
+		// Get number of match groups
+		auto b = std::sregex_iterator(_str.begin(), _str.end(), re);
+		auto e = std::sregex_iterator();
+		if (b->size() != _length <Head> () + 1) {
+			printf("%s[nabu-lexq]%s warning: Regex has an excess capture group."
+				" Please remove any capture groups in lexicon"
+				" regex to receive expected results.\n",
+				NABU_WARNING_COLOR, NABU_RESET_COLOR);
+		}
+
+#endif
+
+		return re;
+	}();
+
+	std::sregex_iterator begin(source.begin(), source.end(), re);
+	std::sregex_iterator end;
+
+	Queue q;
+	q.source = buffer;
+	q.lines = line_index(source);
+	name_tokens <Head> (q);
+
+	const line_index &lines = q.lines;
+	line_cursor lc(lines);
+
+	// Store previous index
+	match_end prev;
+
+	stats_sampler sampler(stats);
+
+	sampler.start();
+	for (auto it = begin; it != end; it++) {
+		size_t pos = it->position();
+		size_t len = it->length();
+
+		sampler.matched();
+
+		if (!ignore_error)
+			check_gap <Head> (source, prev, pos, lines, q, diag);
+
+		int index = match_index <Head> (it);
+
+		if (index < 0 && !ignore_error && diag) {
+			std::vector <std::string> sp = split(source.substr(pos, len));
+
+			auto loc = lines.locate(pos);
+			diag->add(sp.empty() ? std::string(1, source[pos]) : sp[0],
+				loc.first, loc.second);
+			push_error(q, pos, len, loc.first, loc.second);
+		} else if (index < 0 && !ignore_error) {
+			std::string s = source.substr(pos, len);
+			std::vector <std::string> sp = split(s);
+
+			auto loc = lines.locate(pos);
+			int line = loc.first;
+			int col = loc.second;
+
+			if (sp.size() > 0) {
+				std::cout << "Error [2]: " << sp[0] << std::endl;
+				lerror_handler <Head> (sp[0], lines, line, col);
+			}
+			
+			std::cout << "Error [3]: " << s << std::endl;
+			std::string c(1, source[pos]);
+			lerror_handler <Head> ({c}, lines, line, col);
+		}
+
+		if (index >= 0) {
+			const auto &group = (*it)[index + 1];
+			push_token <Head> (q, index, group.first - source.begin(),
+				group.length(), lc);
+			sampler.pushed(token_table <Head> ::info[index], group.length());
+		}
+
+		// Update the previous position
+		prev = match_end(pos + len);
+		sampler.start();
+	}
+
+	return q;
+}
+
+// Lexes q's source from pos into q with the automaton of the current
+// 	mode until stop(pos) holds, as lex_dfa does; the mode stack is
+// 	updated and its changes are recorded in q.switches
+template <bool ignore_error, class Stop>
+size_t lex_modes(Queue &q, size_t pos, match_end &prev, size_t &reach, line_cursor &lc,
+		std::vector <const lexer_mode *> &modes, diagnostics *diag,
+		lexer_stats *stats, Stop stop)
+{
+	const std::string &source = *q.source;
+
+	stats_sampler sampler(stats);
+
+	const char *s = source.data();
+	size_t n = source.size();
+	while (pos < n && !stop(pos)) {
+		const lexer_mode &m = *modes.back();
+
+		int index;
+		bool alive;
+		size_t read;
+
+		sampler.start();
+
+		size_t len = lex_match(*m.tables, *m.filter, m.rules, s + pos,
+			n - pos, index, alive, read);
+
+		reach = std::max(reach, alive ? std::string::npos : pos + read);
+		q.mark(reach);
+
+		if (len == 0) {
+			sampler.skipped();
+			pos++;
+			continue;
+		}
+
+		sampler.matched();
+
+		if (!ignore_error)
+			m.gap(source, prev, pos, lc.index(), q, diag);
+
+		m.push(q, index, pos, len, lc);
+		sampler.pushed(m.info[index], len);
+
+		// Update the previous position
+		pos += len;
+		prev = pos;
+
+		if (m.action[index] != 0) {
+			switch_mode(modes, index);
+			q.switches.push_back({pos, modes});
+		}
+	}
+
+	return pos;
+}
+
+// Lexes a string starting in the mode of Head, with the automaton of the
+// 	current mode (the built-in DFA, also for std_engine lexlists)
+template <class Head, bool ignore_error = false>
+Queue lexq_modes(std::shared_ptr <const std::string> buffer,
+		diagnostics *diag = nullptr, lexer_stats *stats = nullptr)
+{
+	const std::string &source = *buffer;
+
+	Queue q;
+	q.source = buffer;
+	q.lines = line_index(source);
+	name_tokens <Head> (q);
+
+	line_cursor lc(q.lines);
+
+	std::vector <const lexer_mode *> modes {lexer_mode::get <Head> ()};
+
+	// Store previous index
+	match_end prev;
+	size_t reach = 0;
+
+	lex_modes <ignore_error> (q, 0, prev, reach, lc, modes, diag, stats,
+		[](size_t) { return false; });
+
+	return q;
+}
+
+// Lexes a string and returns a queue of tokens, which shares
+// 	ownership of the source with the caller; lexlists with rule
+// 	tokens are lexed with the built-in DFA, and the pass is counted
+// 	in stats (if given)
+template <class Head, bool ignore_error = false>
+Queue lexq(std::shared_ptr <const std::string> source, diagnostics *diag = nullptr,
+		lexer_stats *stats = nullptr)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	Queue q;
+
+	using engine = typename lexer_engine <Head> ::type;
+	if constexpr (has_modes <Head> ()) {
+		q = lexq_modes <Head, ignore_error> (source, diag, stats);
+	} else if constexpr (std::is_same_v <engine, std_engine> && !has_rules <Head> ()) {
+		q = lexq_std <Head, ignore_error> (source, diag, stats);
+	} else {
+		const auto &lexer = dfa_lexer <Head> ::get();
+		q = lexq_dfa <Head, ignore_error> (source, lexer.tables,
+			lexer.filter, diag, stats);
+	}
+
+	if (stats) {
+		std::chrono::duration <double> elapsed = std::chrono::steady_clock::now() - start;
+
+		stats->seconds += elapsed.count();
+		stats->bytes += source->size();
+		stats->queued += q.handles();
+		stats->peak_memory = std::max(stats->peak_memory, q.memory());
+	}
+
+	return q;
+}
+
+template <class Head, bool ignore_error = false>
+Queue lexq(const std::string &source, lexer_stats &stats)
+{
+	return lexq <Head, ignore_error> (std::make_shared <const std::string> (source),
+		nullptr, &stats);
+}
+
+// Lexes a string without stopping at errors: unlexable text is queued
+// 	as lexerror tokens and described in diag
+template <class Head>
+Queue lexq(std::shared_ptr <const std::string> source, diagnostics &diag)
+{
+	return lexq <Head> (source, &diag);
+}
+
+template <class Head>
+Queue lexq(const std::string &source, diagnostics &diag)
+{
+	return lexq <Head> (std::make_shared <const std::string> (source), &diag);
+}
+
+template <class Head>
+Queue lexq(std::string &&source, diagnostics &diag)
+{
+	return lexq <Head> (
+		std::make_shared <const std::string> (std::move(source)), &diag
+	);
+}
+
+// Re-lexes q after source[offset, offset + removed) is replaced with
+// 	inserted: lexing resumes after the last token whose match did not
+// 	read from offset on, and stops at the first old token past the
+// 	edit that it lines up with, in the same modes (the rest of the old
+// 	tokens are kept, shifted); q must have been lexed from the same
+// 	lexlist, and none of its tokens released
+template <class Head, bool ignore_error = false>
+void relex(Queue &q, size_t offset, size_t removed, const std::string &inserted,
+		diagnostics *diag = nullptr)
+{
+	// std::regex does not tell how far it read to match a token
+	using engine = typename lexer_engine <Head> ::type;
+	static_assert(has_modes <Head> () || has_rules <Head> ()
+			|| !std::is_same_v <engine, std_engine>,
+		"nabu: relex needs the built-in DFA, declare the lexlist with"
+		" lexer_engine(Head, nabu::parser::dfa_engine)");
+
+	assert(q.base() == 0);
+
+	// Keeps the old source alive until the lexicons are rebased
+	std::shared_ptr <const std::string> prior = q.source;
+
+	const std::string &old = *prior;
+	offset = std::min(offset, old.size());
+	removed = std::min(removed, old.size() - offset);
+
+	std::string text;
+	text.reserve(old.size() - removed + inserted.size());
+	text.append(old, 0, offset);
+	text.append(inserted);
+	text.append(old, offset + removed, std::string::npos);
+
+	auto buffer = std::make_shared <const std::string> (std::move(text));
+
+	std::ptrdiff_t delta = (std::ptrdiff_t) inserted.size() - (std::ptrdiff_t) removed;
+	size_t end = offset + removed;
+	size_t count = q.handles();
+
+	// Reaches only grow, so the kept tokens are a prefix
+	token_handle first = 0;
+	token_handle last = count;
+	while (first < last) {
+		token_handle mid = first + (last - first) / 2;
+		if (q.reach(mid) <= offset)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	// First old token past the edit
+	token_handle k = first;
+	last = count;
+	while (k < last) {
+		token_handle mid = k + (last - k) / 2;
+		if (q.offset(mid) < end)
+			k = mid + 1;
+		else
+			last = mid;
+	}
+
+	line_index old_lines = std::move(q.lines);
+
+	q.source = buffer;
+	q.lines = line_index(*buffer);
+
+	size_t pos = (first > 0) ? q.offset(first - 1) + q.length(first - 1) : 0;
+	match_end prev = (first > 0) ? match_end(pos) : match_end();
+	size_t reach = (first > 0) ? q.reach(first - 1) : 0;
+
+	Queue fresh;
+	fresh.source = buffer;
+	fresh.symbols = q.symbols;
+
+	line_cursor lc(q.lines, pos);
+
+	// Modes in effect at an offset of the old source
+	std::vector <mode_switch> &switches = q.switches;
+	auto modes_at = [&](size_t at) {
+		auto it = std::upper_bound(switches.begin(), switches.end(), at,
+			[](size_t x, const mode_switch &sw) { return x < sw.offset; });
+
+		if (it == switches.begin())
+			return std::vector <const lexer_mode *> {lexer_mode::get <Head> ()};
+
+		return std::prev(it)->modes;
+	};
+
+	std::vector <const lexer_mode *> modes;
+	if constexpr (has_modes <Head> ())
+		modes = modes_at(pos);
+
+	// Old tokens from k on are lexed the same once an attempt
+	// 	starts where one of them does, in the same modes; their
+	// 	reach carries over once the old tokens before them read no
+	// 	further than the new ones (what was read of the edit counts
+	// 	as read up to its end)
+	auto aligned = [&](size_t at) {
+		while (k < count && q.offset(k) + delta < at)
+			k++;
+
+		if (k == count || q.offset(k) + delta != at
+				|| q.id_at(k) == token <lexerror> ::id)
+			return false;
+
+		if (k > first) {
+			size_t r = q.reach(k - 1);
+			if (r == std::string::npos ? reach != r : std::max(r, end) + delta > reach)
+				return false;
+		}
+
+		if constexpr (has_modes <Head> ())
+			return modes_at(q.offset(k)) == modes;
+
+		return true;
+	};
+
+	if constexpr (has_modes <Head> ()) {
+		pos = lex_modes <ignore_error> (fresh, pos, prev, reach, lc, modes,
+			diag, nullptr, aligned);
+	} else {
+		const auto &lexer = dfa_lexer <Head> ::get();
+		pos = lex_dfa <Head, ignore_error> (fresh, pos, prev, reach, lc,
+			lexer.tables, lexer.filter, diag, nullptr, aligned);
+	}
+
+	if (pos < buffer->size()) {
+		// A gap before the token also depends on its match
+		size_t r = q.reach(k);
+		fresh.mark((r == std::string::npos) ? r : std::max(reach, r + delta));
+
+		if constexpr (has_modes <Head> ()) {
+			if (!ignore_error)
+				modes.back()->gap(*buffer, prev, pos, q.lines, fresh, diag);
+		} else if (!ignore_error) {
+			check_gap <Head> (*buffer, prev, pos, q.lines, fresh, diag);
+		}
+	} else {
+		k = count;
+	}
+
+	// Mode changes before the resumed lexing and after the aligned
+	// 	token are kept, the latter shifted
+	if constexpr (has_modes <Head> ()) {
+		size_t resumed = (first > 0) ? q.offset(first - 1) + q.length(first - 1) : 0;
+		size_t aligned_at = (k < count) ? q.offset(k) : old.size() + 1;
+
+		std::vector <mode_switch> kept;
+		for (mode_switch &sw : switches) {
+			if (sw.offset <= resumed)
+				kept.push_back(std::move(sw));
+		}
+
+		for (mode_switch &sw : fresh.switches)
+			kept.push_back(std::move(sw));
+
+		for (mode_switch &sw : switches) {
+			if (sw.offset > aligned_at) {
+				sw.offset += delta;
+				kept.push_back(std::move(sw));
+			}
+		}
+
+		switches = std::move(kept);
+	}
+
+	q.splice(first, k, fresh, delta, reach, old_lines);
+	q.symbols = fresh.symbols;
+}
+
+// Copies the source into the queue
+template <class Head, bool ignore_error = false>
+Queue lexq(const std::string &source)
+{
+	return lexq <Head, ignore_error> (std::make_shared <const std::string> (source));
+}
+
+// Moves the source into the queue
+template <class Head, bool ignore_error = false>
+Queue lexq(std::string &&source)
+{
+	return lexq <Head, ignore_error> (
+		std::make_shared <const std::string> (std::move(source))
+	);
+}
+
+// Regexes of a lexlist, in order
+template <class T>
+void token_regexes(std::vector <const char *> &regexes, std::vector <int> &ids)
+{
+	regexes.push_back(token <T> ::regex);
+	ids.push_back(token <T> ::id);
+	if constexpr (!lexlist <T> ::tail)
+		token_regexes <typename lexlist <T> ::next> (regexes, ids);
+}
+
+// Automata of the single tokens of a lexlist (set up on first use), for
+// 	lexing on demand
+template <class Head>
+class token_automata {
+	std::vector <dfa::automaton>	_storage;
+
+	token_automata() {
+		std::vector <const char *> regexes;
+		token_regexes <Head> (regexes, ids);
+
+		for (size_t i = 0; i < regexes.size(); i++) {
+			// The regexes were checked with the full automaton
+			const char *error;
+			size_t epos;
+
+			dfa::builder b;
+			b.add(regexes[i], error, epos);
+			_storage.push_back(b.build());
+
+			index[ids[i]] = i;
+		}
+
+		for (const dfa::automaton &a : _storage)
+			tables.push_back(a.view());
+
+		// Rules can match anything, the full lexer always decides
+		extended.assign(ids.size(), true);
+		std::fill(ignorable, ignorable + 256, true);
+		if (!rules_of <Head> ())
+			analyze(dfa_lexer <Head> ::get());
+	}
+
+	// Finds what the full automaton is needed for, by walking it
+	// 	along with the automaton of each token
+	void analyze(const dfa_lexer <Head> &lexer) {
+		const dfa::tables &a = lexer.tables;
+
+		int nstates = a.start + 1;
+		for (size_t k = 0; k < (size_t) nstates * a.nclasses; k++)
+			nstates = std::max(nstates, a.table[k] + 1);
+
+		// States on the way to an ignored token
+		std::vector <char> skips(nstates, 0);
+		for (int f = 0; f < nstates; f++)
+			skips[f] = (a.accept[f] >= 0 && lexer.ignored[a.accept[f]]);
+
+		for (bool changed = true; changed; ) {
+			changed = false;
+			for (int f = 0; f < nstates; f++) {
+				for (int c = 0; c < a.nclasses; c++) {
+					int g = a.table[f * a.nclasses + c];
+					if (g >= 0 && !skips[f] && skips[g])
+						skips[f] = changed = true;
+				}
+			}
+		}
+
+		for (int b = 0; b < 256; b++) {
+			int t = a.table[a.start * a.nclasses + a.classes[b]];
+			ignorable[b] = (t >= 0 && skips[t]);
+		}
+
+		// Keywords are not spelled out in the automaton
+		if (a.kw) {
+			for (size_t w = 0; w < a.kw->words.size(); w++) {
+				if (lexer.ignored[a.kw->indices[w]])
+					ignorable[(uint8_t) a.kw->words[w][0]] = true;
+			}
+		}
+
+		// A token is extended if, once it has matched, the lexlist
+		// 	can match a longer text which the token does not (the
+		// 	token's state is -1 once it is dead)
+		for (size_t k = 0; k < tables.size(); k++) {
+			const dfa::tables &t = tables[k];
+
+			using walk = std::tuple <int, int, bool>;
+
+			std::set <walk> seen {{t.start, a.start, false}};
+			std::vector <walk> stack {{t.start, a.start, false}};
+
+			extended[k] = false;
+			while (!stack.empty() && !extended[k]) {
+				auto [u, f, matched] = stack.back();
+				stack.pop_back();
+
+				bool accepts = (u >= 0 && t.accept[u] >= 0);
+				if (matched && !accepts && a.accept[f] >= 0) {
+					extended[k] = true;
+					break;
+				}
+
+				matched |= accepts;
+				for (int b = 0; b < 256; b++) {
+					int v = (u < 0) ? -1 : t.table[u * t.nclasses + t.classes[b]];
+					int g = a.table[f * a.nclasses + a.classes[b]];
+					if ((v >= 0 || matched) && g >= 0 && seen.insert({v, g, matched}).second)
+						stack.push_back({v, g, matched});
+				}
+			}
+		}
+	}
+public:
+	std::vector <int>		ids;
+	std::vector <dfa::tables>	tables;
+
+	// Position in the lexlist of each token id
+	std::unordered_map <int, int>	index;
+
+	// Whether a longer match of the lexlist can start with a match of
+	// 	each token, and whether an ignored token can start with each
+	// 	byte; only then is the full automaton run
+	std::vector <bool>		extended;
+	bool				ignorable[256];
+
+	// No copy constructor (the tables point into this)
+	token_automata(const token_automata &) = delete;
+	token_automata &operator=(const token_automata &) = delete;
+
+	static const token_automata &get() {
+		static const token_automata automata;
+		return automata;
+	}
+};
+
+// Lexes on demand for the rd parser, trying only the token the grammar
+// 	expects: it is lexed if it is among the longest matches of the
+// 	lexlist there (whichever comes first in it), so keywords and
+// 	identifiers spelled the same are told apart by the grammar;
+// 	tokens lexed for another expectation are dropped first
+//
+// 	Only the automaton of the expected token is run, unless a longer
+// 	match of the lexlist could start there (or ignored tokens could);
+// 	unmatched text is queued as lexerror tokens and reported as lexq
+// 	does, in diag if given
+template <class Head>
+class directed_feed : public token_feed {
+	const token_automata <Head>	&_single = token_automata <Head> ::get();
+	const dfa_lexer <Head>		&_lexer = dfa_lexer <Head> ::get();
+	const rule_dispatch		*_rules = rules_of <Head> ();
+
+	diagnostics			*_diag;
+
+	// From the end of the previous token, ignored tokens were last
+	// 	skipped up to _pos, where the longest match of the lexlist
+	// 	is _len bytes of token _index (once _matched); _prev is the
+	// 	end of the last match before _pos
+	size_t		_from = std::string::npos;
+	size_t		_pos = 0;
+	size_t		_len = 0;
+	int		_index = -1;
+	bool		_matched = false;
+	match_end	_prev;
+
+	// Where the unmatched text last reported was lexed from, it is
+	// 	only queued again after the parser backtracks
+	size_t		_reported = std::string::npos;
+
+	void match(const Queue &q) {
+		if (_matched)
+			return;
+
+		const char *s = q.source->data();
+		size_t n = q.source->size();
+
+		bool alive;
+		size_t read;
+
+		_matched = true;
+		_len = (_pos < n) ? lex_match(_lexer.tables, _lexer.filter,
+			_rules, s + _pos, n - _pos, _index, alive, read) : 0;
+	}
+
+	void look(const Queue &q, size_t from) {
+		if (_from == from)
+			return;
+
+		const char *s = q.source->data();
+		size_t n = q.source->size();
+
+		_from = from;
+		_pos = from;
+		_matched = false;
+		_prev = (from > 0) ? match_end(from) : match_end();
+		while (_pos < n && _single.ignorable[(uint8_t) s[_pos]]) {
+			match(q);
+			if (_len == 0 || !_lexer.ignored[_index])
+				break;
+
+			_pos += _len;
+			_prev = _pos;
+			_matched = false;
+		}
+	}
+
+	// Length of token id (any token if -1) at _pos, 0 if it is not
+	// 	there; k is set to its index
+	size_t expect(const Queue &q, int id, int &k) {
+		if (id < 0) {
+			match(q);
+			k = _index;
+			return _len;
+		}
+
+		auto it = _single.index.find(id);
+		if (it == _single.index.end() || _lexer.ignored[it->second])
+			return 0;
+
+		k = it->second;
+
+		const char *s = q.source->data() + _pos;
+		size_t n = q.source->size() - _pos;
+
+		size_t len;
+		size_t read;
+		if (auto fn = _rules ? _rules->find(k) : nullptr) {
+			len = fn(s, n, read);
+		} else {
+			int i;
+			len = _single.tables[k].match(s, n, i);
+		}
+
+		if (len > 0 && _single.extended[k]) {
+			match(q);
+			if (len != _len)
+				return 0;
+		}
+
+		return len;
+	}
+
+	// Skips the unmatched text at _pos up to the next token, checking
+	// 	the gaps before it and before the ignored tokens in between
+	// 	as lex_dfa does; their lexerror tokens are queued from h on
+	void skip_gap(Queue &q, token_handle h) {
+		const std::string &source = *q.source;
+
+		diagnostics again;
+		diagnostics *diag = (_from == _reported) ? &again : _diag;
+
+		q.truncate(h);
+		while (_pos < source.size()) {
+			match(q);
+			if (_len == 0) {
+				_pos++;
+				_matched = false;
+				continue;
+			}
+
+			check_gap <Head> (source, _prev, _pos, q.lines, q, diag);
+			if (!_lexer.ignored[_index])
+				break;
+
+			_pos += _len;
+			_prev = _pos;
+			_matched = false;
+		}
+
+		// Lexed again (without reporting) if the parser backtracks
+		if (q.handles() > h) {
+			_reported = _from;
+			_from = std::string::npos;
+		}
+	}
+public:
+	directed_feed(diagnostics *diag = nullptr) : _diag(diag) {}
+
+	bool directed() const override {
+		return true;
+	}
+
+	bool next(Queue &q, int id) override {
+		token_handle h = q.cursor();
+		if (h < q.handles() && (id < 0 || q.id_at(h) == id))
+			return true;
+
+		// Unmatched text queued there comes before any token
+		if (h < q.handles() && q.id_at(h) == token <lexerror> ::id)
+			return false;
+
+		size_t from = (h > 0) ? q.offset(h - 1) + q.length(h - 1) : 0;
+		look(q, from);
+
+		size_t n = q.source->size();
+		if (_pos >= n)
+			return false;
+
+		int k = -1;
+		size_t len = expect(q, id, k);
+		if (len == 0) {
+			match(q);
+			if (_len > 0)
+				return false;
+
+			skip_gap(q, h);
+			if (q.handles() > h || _pos >= n)
+				return false;
+
+			len = expect(q, id, k);
+		}
+
+		if (len == 0)
+			return false;
+
+		q.truncate(h);
+
+		line_cursor lc(q.lines, _pos);
+		push_token <Head> (q, k, _pos, len, lc);
+		return true;
+	}
+};
+
+// Queue of a source lexed on demand by the rd parser: each token is
+// 	lexed when the grammar asks for one, trying only the token it
+// 	expects (with DualQueue::expect); tokens are not lexed ahead, so
+// 	the queue looks empty until then; errors are recorded in diag
+// 	(if given) instead of being reported
+template <class Head>
+Queue lexq_directed(std::shared_ptr <const std::string> source,
+		diagnostics *diag = nullptr)
 {
-	if (lexlist <T> ::tail)
-		return 1;
+	check_cyclic <Head> ();
 
-	return 1 + _length <typename lexlist <T> ::next> ();
+	Queue q;
+	q.source = source;
+	q.lines = line_index(*source);
+	name_tokens <Head> (q);
+	q.feed = std::make_shared <directed_feed <Head>> (diag);
+	return q;
 }
 
-// Compile the regex for a set of lexical rules
 template <class Head>
-inline std::regex compile()
+Queue lexq_directed(const std::string &source, diagnostics *diag = nullptr)
 {
-	// First make sure the list is not cyclic
-	std::set <int> ids;
+	return lexq_directed <Head> (std::make_shared <const std::string> (source), diag);
+}
 
-	ID_TYPE id = is_cyclic <Head> (ids);
-	if (id != ID_NULL) {
+template <class Head>
+Queue lexq_directed(std::string &&source, diagnostics *diag = nullptr)
+{
+	return lexq_directed <Head> (
+		std::make_shared <const std::string> (std::move(source)), diag
+	);
+}
 
-#ifdef NABU_DEBUG_PARSER
+// Where lexq_parallel may split a source: just after an occurrence of
+// 	the string, a newline unless declared with lexer_boundary
+template <class Head>
+struct lexer_boundary {
+	static constexpr const char *value = "\n";
+};
 
-		std::string id_str = id;
+#define lexer_boundary(Head, str)			\
+	template <>					\
+	struct nabu::parser::lexer_boundary <Head> {	\
+		static constexpr const char *value = str;	\
+	};
 
-#else
+// Matches of a DFA over one chunk of a source
+struct lex_span {
+	static constexpr size_t npos = std::string::npos;
 
-		std::string id_str = std::to_string(id);
+	// Match attempts, unmatched bytes have index -1 and length 0,
+	// 	and the end of the source each attempt read
+	std::vector <int>	indices;
+	std::vector <size_t>	offsets;
+	std::vector <size_t>	lengths;
+	std::vector <size_t>	reads;
 
-#endif
+	// Start of the first match that ran into the end of the chunk
+	// 	(the full source could extend it), the chunk is only
+	// 	trusted up to there
+	size_t			unsafe = npos;
 
-		std::cerr << "[nabu] Error: lexical rule list is cyclic at (id: "
-			<< id_str << ")" << std::endl;
-		exit(1);
+	void push(int index, size_t offset, size_t length, size_t read) {
+		indices.push_back(index);
+		offsets.push_back(offset);
+		lengths.push_back(length);
+		reads.push_back(read);
 	}
 
-	try {
-		// TODO: an option to choose between different regex engines
-		// either macro or struct option
-		return std::regex(
-			concat <Head> (),
-			std::regex::ECMAScript | std::regex::optimize
-		);
-	} catch (std::regex_error &e) {
-		regex_error_handle <Head> ();
+	// Whether a scan of the full source at pos lines up with this
+	// 	chunk, i.e. pos is not inside one of its matches
+	bool aligned(size_t pos) const {
+		size_t k = std::lower_bound(offsets.begin(), offsets.end(), pos)
+			- offsets.begin();
+		return k == 0 || offsets[k - 1] + lengths[k - 1] <= pos;
 	}
+};
 
-	return std::regex {};
-}
+// Matches [begin, end) of s, stopping at the first match which
+// 	could continue past end (unless end is the end of s)
+inline void lex_chunk(const dfa::tables &a, const dfa::prefilter &filter,
+		const rule_dispatch *rules, const std::string &s, size_t begin,
+		size_t end, lex_span &span)
+{
+	size_t pos = begin;
+	while (pos < end) {
+		int index;
+		bool alive;
+		size_t read;
+		size_t len = lex_match(a, filter, rules, s.data() + pos, end - pos,
+			index, alive, read);
+		if (alive && end < s.size()) {
+			span.unsafe = pos;
+			return;
+		}
 
-// Create the line and column table for a string
-using line_table = std::vector <std::pair <int, int>>;
-using line_list = std::vector <std::string>;
+		// Unmatched bytes are checked as gaps when merging
+		size_t reach = alive ? std::string::npos : pos + read;
+		if (len == 0) {
+			span.push(-1, pos, 0, reach);
+			pos++;
+			continue;
+		}
+
+		span.push(index, pos, len, reach);
+		pos += len;
+	}
+}
 
-inline line_table line_column(const std::string &str)
+// Lexes a string on several threads: the source is split into chunks
+// 	after lexer boundaries, each chunk is matched on its own and the
+// 	results are stitched back, re-lexing sequentially wherever a
+// 	match crosses a split; the queue (and any gap errors) is the same
+// 	as with lexq; lexlists with modes are lexed sequentially, since
+// 	the mode at a split is not known, and so are std_engine
+// 	lexlists, whose first-alternative matches the DFA does not make
+template <class Head, bool ignore_error = false>
+Queue lexq_parallel(std::shared_ptr <const std::string> buffer,
+		unsigned threads = 0, size_t chunk = 1 << 20,
+		diagnostics *diag = nullptr)
 {
-	line_table ret;
+	using engine = typename lexer_engine <Head> ::type;
+	if constexpr (has_modes <Head> ())
+		return lexq_modes <Head, ignore_error> (buffer, diag);
+	else if constexpr (std::is_same_v <engine, std_engine> && !has_rules <Head> ())
+		return lexq_std <Head, ignore_error> (buffer, diag);
 
-	int line = 1;
-	int column = 1;
+	const std::string &source = *buffer;
 
-	for (int i = 0; i < str.size(); i++) {
-		ret.push_back(std::make_pair(line, column));
+	const auto &lexer = dfa_lexer <Head> ::get();
+	const dfa::tables &a = lexer.tables;
+	const dfa::prefilter &filter = lexer.filter;
+	const rule_dispatch *rules = rules_of <Head> ();
 
-		if (str[i] == '\n') {
-			line++;
-			column = 1;
-		} else {
-			column++;
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	chunk = std::max <size_t> (chunk, 1);
+
+	// Split points, each just after a boundary
+	std::string_view view(source);
+	std::string_view boundary(lexer_boundary <Head> ::value);
+
+	std::vector <size_t> bounds {0};
+	while (source.size() - bounds.back() > chunk) {
+		size_t k = view.find(boundary, bounds.back() + chunk);
+		if (k == std::string_view::npos || boundary.empty())
+			break;
+
+		bounds.push_back(k + boundary.size());
+	}
+
+	if (bounds.back() < source.size())
+		bounds.push_back(source.size());
+
+	size_t nchunks = bounds.size() - 1;
+	if (threads == 1 || nchunks <= 1)
+		return lexq_dfa <Head, ignore_error> (buffer, a, filter, diag);
+
+	// Match the chunks on a pool of workers
+	std::vector <lex_span> spans(nchunks);
+	std::atomic <size_t> next {0};
+
+	auto work = [&]() {
+		size_t i;
+		while ((i = next++) < nchunks)
+			lex_chunk(a, filter, rules, source, bounds[i], bounds[i + 1], spans[i]);
+	};
+
+	std::vector <std::thread> pool;
+	for (size_t i = 1; i < std::min <size_t> (threads, nchunks); i++)
+		pool.emplace_back(work);
+
+	work();
+	for (auto &t : pool)
+		t.join();
+
+	Queue q;
+	q.source = buffer;
+	q.lines = line_index(source);
+	name_tokens <Head> (q);
+
+	const line_index &lines = q.lines;
+	line_cursor lc(lines);
+
+	// Check gaps and fill the queue in order, recording the reach of
+	// 	the tokens as lexq_dfa does
+	match_end prev;
+	size_t reach = 0;
+	auto emit = [&](int index, size_t offset, size_t len, size_t read) {
+		reach = std::max(reach, read);
+		q.mark(reach);
+		if (len == 0)
+			return;
+
+		if (!ignore_error)
+			check_gap <Head> (source, prev, offset, lines, q, diag);
+
+		push_token <Head> (q, index, offset, len, lc);
+		prev = offset + len;
+	};
+
+	// Stitch the chunks, scanning the full source sequentially until
+	// 	it lines up with the next chunk
+	size_t pos = 0;
+	auto step = [&]() {
+		const char *s = source.data() + pos;
+		size_t n = source.size() - pos;
+
+		int index;
+		bool alive;
+		size_t read;
+		size_t len = lex_match(a, filter, rules, s, n, index, alive, read);
+		emit(index, pos, len, alive ? std::string::npos : pos + read);
+		pos += std::max <size_t> (len, 1);
+	};
+
+	for (size_t i = 0; i < nchunks; i++) {
+		const lex_span &span = spans[i];
+		size_t limit = std::min(span.unsafe, bounds[i + 1]);
+
+		while (pos < limit && !span.aligned(pos))
+			step();
+
+		if (pos < limit) {
+			size_t k = std::lower_bound(span.offsets.begin(),
+				span.offsets.end(), pos) - span.offsets.begin();
+
+			for (; k < span.offsets.size(); k++)
+				emit(span.indices[k], span.offsets[k],
+					span.lengths[k], span.reads[k]);
+
+			pos = limit;
 		}
+
+		while (pos < bounds[i + 1])
+			step();
 	}
 
-	return ret;
+	return q;
 }
 
-inline line_list split_lines(const std::string &str)
+// Copies the source into the queue
+template <class Head, bool ignore_error = false>
+Queue lexq_parallel(const std::string &source, unsigned threads = 0,
+		size_t chunk = 1 << 20, diagnostics *diag = nullptr)
 {
-	line_list ret;
+	return lexq_parallel <Head, ignore_error> (
+		std::make_shared <const std::string> (source),
+		threads, chunk, diag
+	);
+}
 
-	std::string line;
-	
-	std::string tmp = str + "\n";
-	for (int i = 0; i < tmp.size(); i++) {
-		if (tmp[i] == '\n') {
-			ret.push_back(line);
-			line.clear();
-		} else {
-			line += tmp[i];
+// Bounded queue between one producer thread and one consumer thread,
+// 	without locks: each side owns one index and only reads the other
+template <class T>
+class spsc_ring {
+	std::vector <T>			_slots;
+	size_t				_mask;
+
+	// Next slot to read and to write, on separate cache lines
+	alignas(64) std::atomic <size_t>	_head {0};
+	alignas(64) std::atomic <size_t>	_tail {0};
+	alignas(64) std::atomic <bool>		_closed {false};
+public:
+	// Capacity is rounded up to a power of two
+	spsc_ring(size_t capacity) {
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+
+		_slots.resize(size);
+		_mask = size - 1;
+	}
+
+	// Producer: stores a value, waiting while the ring is full; false
+	// 	if the consumer closed it
+	bool push(const T &value) {
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		while (tail - _head.load(std::memory_order_acquire) > _mask) {
+			if (_closed.load(std::memory_order_acquire))
+				return false;
+
+			std::this_thread::yield();
 		}
+
+		_slots[tail & _mask] = value;
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
 	}
 
-	return ret;
-}
+	// Consumer: hands the available values to f, waiting for at least
+	// 	one; false once the ring is closed and drained
+	template <class F>
+	bool pop(F f) {
+		size_t head = _head.load(std::memory_order_relaxed);
+		size_t tail;
+		while ((tail = _tail.load(std::memory_order_acquire)) == head) {
+			if (_closed.load(std::memory_order_acquire)) {
+				// Values pushed just before closing
+				tail = _tail.load(std::memory_order_acquire);
+				if (tail == head)
+					return false;
 
-// Convert a matched token to its token value
-template <class Head>
-parser::lexicon match(std::sregex_iterator &it, const line_table &ltbl, bool &ignored, int index = 0)
-{
-	// Alias to keep things clean
-	using Node = token <Head>;
-	using Next = typename lexlist <Head> ::next;
+				break;
+			}
 
-	// If the next one is not empty, we have reached
-	if (it->str(index + 1).size() > 0) {
-		size_t sindex = it->position(index + 1);
+			std::this_thread::yield();
+		}
 
-		size_t line = ltbl[sindex].first;
-		size_t col = ltbl[sindex].second;
+		for (; head != tail; head++)
+			f(_slots[head & _mask]);
 
-		if (ignore <Head> ::value)
-			ignored = true;
+		_head.store(head, std::memory_order_release);
+		return true;
+	}
 
-		if (Node::overloaded) {
+	// Either side: no more values will be pushed
+	void close() {
+		_closed.store(true, std::memory_order_release);
+	}
 
-#ifdef NABU_DEBUG_PARSER
+	// Consumer: values may be pushed again, once no producer runs
+	void reopen() {
+		_closed.store(false, std::memory_order_release);
+	}
+};
 
-			return parser::lexicon(new parser::lexvalue
-				<typename Node::cast_type> (
-					Node::cast(it->str(index + 1)),
-					Node::id, Node::name, line, col
-				)
-			);
+// Lexes on a thread of its own while the rd parser reads the queue: the
+// 	matches are handed over through a bounded ring (the lexer waits
+// 	while it is full), and turned into tokens when the parser runs
+// 	out of them
+template <class Head, bool ignore_error = false>
+class pipeline_feed : public token_feed {
+	// A match and the end of the one before it (for gap checks)
+	struct entry {
+		const lexer_mode	*mode;
+		int			index;
+		size_t			len;
+		size_t			offset;
+		match_end		prev;
+	};
 
-#else
+	std::shared_ptr <const std::string>	_source;
+	spsc_ring <entry>			_ring;
+	diagnostics				*_diag;
 
-			return parser::lexicon(new parser::lexvalue
-				<typename Node::cast_type> (
-					Node::cast(it->str(index + 1)),
-					Node::id, line, col
-				)
-			);
+	std::thread				_thread;
 
-#endif
+	// Where the lexer thread is (it resumes there after a stop)
+	std::vector <const lexer_mode *>	_modes {lexer_mode::get <Head> ()};
+	match_end				_prev;
+	size_t					_pos = 0;
 
-		} else {
+	void lex() {
+		const std::string &source = *_source;
 
-#ifdef NABU_DEBUG_PARSER
+		std::vector <const lexer_mode *> &modes = _modes;
+		match_end &prev = _prev;
+		size_t &pos = _pos;
 
-			return parser::lexicon(
-				new parser::lexvalue <std::string> (
-					it->str(index + 1),
-					Node::id, Node::name, line, col
-				)
-			);
+		const char *s = source.data();
+		size_t n = source.size();
+		while (pos < n) {
+			const lexer_mode &m = *modes.back();
 
-#else
+			int index;
+			bool alive;
+			size_t read;
 
-			return parser::lexicon(
-				new parser::_lexvalue(
-					Node::id, line, col
-				)
-			);
+			size_t len = lex_match(*m.tables, *m.filter, m.rules, s + pos,
+				n - pos, index, alive, read);
 
-#endif
+			if (len == 0) {
+				pos++;
+				continue;
+			}
+
+			// Ignored tokens are only handed over after gaps
+			size_t start;
+			bool gap = prev.gap(pos, start);
+			if ((gap || !(*m.ignored)[index]) && !_ring.push({&m, index,
+					len, pos, prev}))
+				return;
+
+			switch_mode(modes, index);
 
+			pos += len;
+			prev = pos;
 		}
+
+		_ring.close();
 	}
 
-	// Walk the list of tokens (if any left)
-	if (!lexlist <Head> ::tail)
-		return match <Next> (it, ltbl, ignored, index + 1);
+	// Stops the lexer thread, the matches it handed over stay queued
+	void stop() {
+		_ring.close();
+		if (_thread.joinable())
+			_thread.join();
+	}
 
-	return nullptr;
-}
+	void resume() {
+		if (_pos >= _source->size())
+			return;
 
-// Default error for lexing
-[[noreturn]]
-inline void error(const std::string &str, const line_list &lines, int line, int col)
+		_ring.reopen();
+		_thread = std::thread(&pipeline_feed::lex, this);
+	}
+public:
+	pipeline_feed(std::shared_ptr <const std::string> source, size_t capacity,
+			diagnostics *diag)
+			: _source(source), _ring(capacity), _diag(diag) {
+		_thread = std::thread(&pipeline_feed::lex, this);
+	}
+
+	~pipeline_feed() {
+		stop();
+	}
+
+	bool next(Queue &q, int id) override {
+		token_handle h = q.cursor();
+		while (h >= q.handles()) {
+			line_cursor lc(q.lines, q.handles() ? q.offset(q.handles() - 1) : 0);
+
+			bool more = _ring.pop([&](const entry &e) {
+				// Without diag the error handler is called with
+				// 	the lexer thread stopped, as it may exit
+				bool fatal = !ignore_error && !_diag
+					&& has_gap(*_source, e.prev, e.offset);
+				if (fatal)
+					stop();
+
+				if (!ignore_error)
+					e.mode->gap(*_source, e.prev, e.offset, q.lines, q, _diag);
+
+				if (fatal)
+					resume();
+
+				e.mode->push(q, e.index, e.offset, e.len, lc);
+			});
+
+			if (!more)
+				return false;
+		}
+
+		return id < 0 || q.id_at(h) == id;
+	}
+};
+
+// Queue lexed on another thread while it is parsed, as the rd parser
+// 	reaches its end; at most capacity matches are lexed ahead, and
+// 	the tokens (and errors) are those of lexq with the built-in DFA
+template <class Head, bool ignore_error = false>
+Queue lexq_pipelined(std::shared_ptr <const std::string> source,
+		size_t capacity = 1 << 14, diagnostics *diag = nullptr)
 {
-	std::string line_str = lines[line - 1];
-	// std::cout << "[nabu] Error: \"" << line_str << "\"" << std::endl;
-	printf("%s[nabu-lexq]%s error: read bad lexicon \"%s\" at line %d, column %d\n",
-		NABU_ERROR_COLOR, NABU_RESET_COLOR,
-		str.c_str(), line, col);
-	printf(" %5d | %s%s%s\n", line,
-		NABU_ERROR_COLOR, line_str.c_str(),
-		NABU_RESET_COLOR);
-	std::string space(col - 1, ' ');
-	std::string squiggle(line_str.size() - col, '~');
-	printf(" %5c | %s%s^%s%s\n", ' ',
-		NABU_ERROR_COLOR, space.c_str(),
-		squiggle.c_str(), NABU_RESET_COLOR);
-	exit(1);
+	check_cyclic <Head> ();
+
+	Queue q;
+	q.source = source;
+	q.lines = line_index(*source);
+	name_tokens <Head> (q);
+	q.feed = std::make_shared <pipeline_feed <Head, ignore_error>> (source,
+		capacity, diag);
+
+	return q;
 }
 
-// Split a string without spaces
-inline std::vector <std::string> split(const std::string &str)
+template <class Head, bool ignore_error = false>
+Queue lexq_pipelined(const std::string &source, size_t capacity = 1 << 14,
+		diagnostics *diag = nullptr)
 {
-	std::vector <std::string> ret;
+	return lexq_pipelined <Head, ignore_error> (
+		std::make_shared <const std::string> (source),
+		capacity, diag
+	);
+}
 
-	std::string curr;
-	std::string content = str + '\n';
-	for (int i = 0; i < content.length(); i++) {
-		char c = content[i];
-		if (isspace(c)) {
-			if (curr.length() > 0) {
-				ret.push_back(curr);
-				curr.clear();
+// Lexes an input stream in bounded chunks, handing out tokens on demand
+//	only the unconsumed input is buffered, so memory stays proportional
+//	to the chunk size and the longest token rather than to the input;
+//	std_engine lexlists are streamed with the runtime DFA
+template <class Head, bool ignore_error = false>
+class lexstream {
+	std::istream	&_in;
+	size_t		_chunk;
+	bool		_eof = false;
+
+	// Mode stack, the current mode is last
+	std::vector <const lexer_mode *>	_modes {lexer_mode::get <Head> ()};
+
+	// Errors are recorded here (if set) instead of being reported
+	diagnostics	*_diag;
+
+	// Symbols of interned tokens
+	symbol_table	_symbols;
+
+	// Buffered input, _buffer[0] is at _offset in the stream
+	std::string	_buffer;
+	size_t		_offset = 0;
+	size_t		_pos = 0;
+
+	// Location of _buffer[_pos] and start of its line
+	int		_line = 1;
+	int		_col = 1;
+	size_t		_line_start = 0;
+
+	// End of the previous match (none at the start, as in lexq)
+	match_end	_prev;
+
+	// Unmatched bytes since the previous match, up to the first byte of
+	// 	their second word (counted in _gap_words)
+	std::string	_gap;
+	int		_gap_words = 0;
+	bool		_gap_space = false;
+	int		_gap_line = 1;
+	int		_gap_col = 1;
+	size_t		_gap_line_start = 0;
+
+	// Reads another chunk, dropping consumed input first
+	bool fill() {
+		if (_eof)
+			return false;
+
+		// Keep the line of the current position (for errors)
+		// 	but never more than a chunk behind it
+		size_t start = _gap.empty() ? _line_start : _gap_line_start;
+		size_t keep = std::min(_pos, start - std::min(start, _offset));
+
+		keep = std::max(keep, _pos > _chunk ? _pos - _chunk : 0);
+
+		_buffer.erase(0, keep);
+		_offset += keep;
+		_pos -= keep;
+
+		size_t size = _buffer.size();
+		_buffer.resize(size + _chunk);
+		_in.read(&_buffer[size], _chunk);
+
+		size_t read = _in.gcount();
+		_buffer.resize(size + read);
+
+		if (!_in)
+			_eof = true;
+
+		return read > 0;
+	}
+
+	// Moves past n buffered bytes
+	void advance(size_t n) {
+		for (size_t i = _pos; i < _pos + n; i++) {
+			if (_buffer[i] == '\n') {
+				_line++;
+				_col = 1;
+				_line_start = _offset + i + 1;
+			} else {
+				_col++;
 			}
-		} else {
-			curr += c;
 		}
+
+		_pos += n;
 	}
 
-	return ret;
-}
+	// Report unmatched text like check_gap does, with diagnostics it is
+	// 	recorded and returned as a lexerror token instead
+	lexicon check_gap() {
+		std::vector <std::string> sp = split(_gap);
+		if (sp.empty())
+			return nullptr;
+
+		if (_diag) {
+			_diag->add(sp[0], _gap_line, _gap_col + 1);
+
+#ifdef NABU_DEBUG_PARSER
+
+			lexicon lptr(new lexvalue <std::string> (_gap,
+				token <lexerror> ::id, token <lexerror> ::name,
+				_gap_line, _gap_col));
+
+#else
+
+			lexicon lptr(new lexvalue <std::string> (_gap,
+				token <lexerror> ::id, _gap_line, _gap_col));
+
+#endif
 
-// Lexer error handler
-// TODO: docs -> specialize to overload the handling
-template <class Head>
-void lerror_handler(const std::string &err, const line_list &lines, int line, int col)
-{
-	error(err, lines, line, col);
-}
+			lptr->text = *lptr->owned();
+			return lptr;
+		}
 
-// Lexes a string and returns a queue of tokens
-template <class Head, bool ignore_error = false>
-Queue lexq(const std::string &source)
-{
-	std::regex re = compile <Head> ();
+		// Line of the gap, as far as it is still buffered
+		size_t begin = std::max(_gap_line_start, _offset) - _offset;
+		size_t end = _buffer.find('\n', begin);
+		while (end == std::string::npos && fill()) {
+			begin = std::max(_gap_line_start, _offset) - _offset;
+			end = _buffer.find('\n', begin);
+		}
 
-#ifdef NABU_DEBUG_PARSER
-	
-	printf("%s[nabu-lexq]%s successfully compiled regex: \"%s\"\n",
-		NABU_OK_COLOR, NABU_RESET_COLOR,
-		concat <Head> ().c_str());
+		if (end == std::string::npos)
+			end = _buffer.size();
+
+		line_index lines(_buffer.data() + begin, end - begin, _gap_line);
 
-	// The idea is to use the regex on a string
-	// 	with all possible characters, so that
-	// 	at least one of them will match
-	std::string _str = "";
-	for (int c = 32; c < 255; c++) {
-		if (isprint(c))
-			_str += (char) c;
+		_modes.back()->error(sp[0], lines, _gap_line, _gap_col + 1);
+		return nullptr;
 	}
+public:
+	// With diag, unlexable text is handed out as lexerror tokens
+	// 	(holding its first words) and described in diag
+	lexstream(std::istream &in, size_t chunk = 1 << 16, diagnostics *diag = nullptr)
+			: _in(in), _chunk(std::max(chunk, (size_t) 1)), _diag(diag) {}
 
-	// Get number of match groups
-	auto b = std::sregex_iterator(_str.begin(), _str.end(), re);
-	auto e = std::sregex_iterator();
-	if (b->size() != _length <Head> () + 1) {
-		printf("%s[nabu-lexq]%s warning: Regex has an excess capture group."
-			" Please remove any capture groups in lexicon"
-			" regex to receive expected results.\n",
-			NABU_WARNING_COLOR, NABU_RESET_COLOR);
+	// No copy constructor
+	lexstream(const lexstream &) = delete;
+	lexstream &operator=(const lexstream &) = delete;
+
+	// Symbols of the interned tokens handed out so far
+	const symbol_table &symbols() const {
+		return _symbols;
 	}
 
-#endif
+	// Next token, or nullptr at the end of the stream; the buffer is
+	// 	reused, so tokens own their text (overloaded ones have none)
+	lexicon next() {
+		while (true) {
+			if (_pos >= _buffer.size() && !fill())
+				return nullptr;
 
-	std::sregex_iterator begin(source.begin(), source.end(), re);
-	std::sregex_iterator end;
+			int index;
+			bool alive;
+			size_t read;
 
-	line_table ltbl = line_column(source);
-	line_list lines = split_lines(source);
+			const char *s = _buffer.data() + _pos;
+			size_t n = _buffer.size() - _pos;
 
-	// Store previous index
-	int prev = -1;
+			const lexer_mode &m = *_modes.back();
 
-	Queue q;
-	for (auto it = begin; it != end; it++) {
-		int pos = it->position();
-		int len = it->length();
+			size_t len = lex_match(*m.tables, *m.filter, m.rules, s, n,
+				index, alive, read);
 
-		if (pos > prev + 1 && !ignore_error) {
-			// Make sure prev is a valid index
-			prev = std::max(0, prev);
-			std::string s = source.substr(prev, pos - prev);
-			std::vector <std::string> sp = split(s);
+			// The match may continue into the next chunk
+			if (alive && fill())
+				continue;
 
-			if (sp.size() > 0) {
-				/*std::cout << "Error [1]: " << sp[0] << std::endl;
-				for (int i = 0; i < prev + 1; i++) {
-					int line = ltbl[i].first;
-					int col = ltbl[i].second;
-					std::cout << "char: " << source[i] << " line: " << line << " col: " << col << std::endl;
-				} */
+			size_t pos = _offset + _pos;
 
-				lerror_handler <Head> (sp[0], lines,
-					ltbl[prev].first, ltbl[prev].second + 1);
+			// Unmatched byte, only the first word of a gap is kept
+			if (len == 0) {
+				if (_gap.empty()) {
+					_gap_line = _line;
+					_gap_col = _col;
+					_gap_line_start = _line_start;
+				}
+
+				char c = _buffer[_pos];
+				if (_gap_words < 2) {
+					_gap += c;
+					if (isspace(c)) {
+						_gap_space = true;
+					} else if (_gap_words == 0 || _gap_space) {
+						_gap_words++;
+						_gap_space = false;
+					}
+				}
+
+				advance(1);
+				continue;
 			}
-		}
 
-		bool ignored = false;
-		parser::lexicon lptr = match <Head> (it, ltbl, ignored);
+			lexicon error;
+			size_t start;
+			if (!ignore_error && _prev.gap(pos, start))
+				error = check_gap();
 
-		if (lptr == nullptr && !ignore_error && !ignored) {
-			std::string s = source.substr(pos, len);
-			std::vector <std::string> sp = split(s);
+			_gap.clear();
+			_gap_words = 0;
+			_gap_space = false;
 
-			int line = ltbl[pos].first;
-			int col = ltbl[pos].second;
+			// The match is lexed again on the next call
+			if (error)
+				return error;
 
-			if (sp.size() > 0) {
-				std::cout << "Error [2]: " << sp[0] << std::endl;
-				lerror_handler <Head> (sp[0], lines, line, col);
+			switch_mode(_modes, index);
+
+			// Ignored tokens are dropped without being constructed
+			if ((*m.ignored)[index]) {
+				advance(len);
+				_prev = match_end(pos + len);
+				continue;
 			}
-			
-			std::cout << "Error [3]: " << s << std::endl;
-			std::string c(1, source[pos]);
-			lerror_handler <Head> ({c}, lines, line, col);
+
+			bool ignored = false;
+			lexicon lptr = m.emit(index, _buffer.data() + _pos,
+				len, _line, _col, ignored);
+
+			if (m.interned[index])
+				lptr->symbol = _symbols.add(std::string_view(s, len));
+
+			advance(len);
+			_prev = match_end(pos + len);
+
+			if (!ignored)
+				return lptr;
+		}
+	}
+
+	// Input iterator over the remaining tokens
+	class iterator {
+		lexstream	*_stream;
+		lexicon		_lptr;
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = lexicon;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const lexicon *;
+		using reference = const lexicon &;
+
+		iterator(lexstream *stream = nullptr) : _stream(stream) {
+			if (_stream && !(_lptr = _stream->next()))
+				_stream = nullptr;
+		}
+
+		const lexicon &operator*() const {
+			return _lptr;
 		}
 
-		if (!ignored)
-			q.push_back(lptr);
+		iterator &operator++() {
+			if (!(_lptr = _stream->next()))
+				_stream = nullptr;
 
-		// Update the previous position
-		prev = pos + len;
+			return *this;
+		}
+
+		bool operator==(const iterator &it) const {
+			return _stream == it._stream;
+		}
+
+		bool operator!=(const iterator &it) const {
+			return _stream != it._stream;
+		}
+	};
+
+	iterator begin() {
+		return iterator(this);
+	}
+
+	iterator end() {
+		return iterator();
+	}
+};
+
+// Feeds a Queue from a lexstream, one token at a time
+template <class Head, bool ignore_error = false>
+class stream_feed : public token_feed {
+	lexstream <Head, ignore_error>	_stream;
+	bool				_done = false;
+public:
+	stream_feed(std::istream &in, size_t chunk, diagnostics *diag)
+			: _stream(in, chunk, diag) {}
+
+	bool next(Queue &q, int id) override {
+		while (q.empty() && !_done) {
+			lexicon lptr = _stream.next();
+			if (!lptr)
+				_done = true;
+			else
+				q.push(0, 0, lptr);
+		}
+
+		return !q.empty() && (id < 0 || q.front_id() == id);
 	}
+};
+
+// Queue lexed from an input stream as the rd parser reaches its end;
+// 	with DualQueue::commit between top level parses, neither the input
+// 	nor the tokens are kept past what the parser can still restore
+// 	(tokens own their text and have no source spans)
+template <class Head, bool ignore_error = false>
+Queue lexq_stream(std::istream &in, size_t chunk = 1 << 16,
+		diagnostics *diag = nullptr)
+{
+	check_cyclic <Head> ();
+
+	Queue q;
+	q.feed = std::make_shared <stream_feed <Head, ignore_error>> (in,
+		chunk, diag);
 
 	return q;
 }
@@ -2791,12 +7946,156 @@ struct _debugger {
 		using production_rule = T; \
 	};
 
-// Dual queue system for parsing and restoring on failure
+// Defines which rules are memoized: their result at each token is kept
+// 	for the rest of the parse, so backtracking into them again costs
+// 	nothing (not for queues from lexq_directed, whose tokens depend
+// 	on what the parser expects)
+template <class T>
+struct memoize {
+	static constexpr bool value = false;
+};
+
+#define memoize(T)						\
+	template <>						\
+	struct nabu::parser::rd::memoize <T> {			\
+		static constexpr bool value = true;		\
+	};
+
+// Dense index of a rule type, for memo keys
+inline int next_rule_index()
+{
+	static std::atomic <int> next {0};
+	return next++;
+}
+
+template <class T>
+int rule_index()
+{
+	static const int index = next_rule_index();
+	return index;
+}
+
+// Results of memoized rules by rule and starting token, a failure is
+// 	kept as a null value; the options a result was parsed with are
+// 	kept too, since other parses of its tokens set theirs
+struct memo_table {
+	// Options of a lexicon at some point of the parse
+	struct options_state {
+		lexicon			lptr;
+		uint64_t		options;
+		std::vector <uint64_t>	spilled;
+
+		options_state(const lexicon &lptr_)
+				: lptr(lptr_), options(lptr_->options) {
+			if (lptr->spilled)
+				spilled = *lptr->spilled;
+		}
+
+		void apply() const {
+			lptr->reset_options();
+			lptr->options = options;
+			if (!spilled.empty())
+				lptr->spilled = std::make_unique <std::vector <uint64_t>> (spilled);
+		}
+	};
+
+	struct entry {
+		lexicon				value;
+		token_handle			end;
+		std::vector <options_state>	options;
+	};
+
+	std::unordered_map <uint64_t, entry> map;
+
+	// Options set while memoized rules are parsed, in order
+	std::vector <options_state>	written;
+	int				recording = 0;
+
+	// Rules being parsed, the memo is cleared when the outermost
+	// 	one returns
+	int				depth = 0;
+
+	static uint64_t key(int rule, token_handle h) {
+		return ((uint64_t) rule << 32) | h;
+	}
+
+	const entry *find(int rule, token_handle h) const {
+		auto it = map.find(key(rule, h));
+		return (it == map.end()) ? nullptr : &it->second;
+	}
+
+	// Notes the options of a lexicon after they are set
+	void note(const lexicon &lptr) {
+		if (recording)
+			written.emplace_back(lptr);
+	}
+
+	// Starts parsing a memoized rule, returns the mark to add it with
+	size_t record() {
+		recording++;
+		return written.size();
+	}
+
+	void add(int rule, token_handle h, const lexicon &value, token_handle end,
+			size_t mark) {
+		entry &e = map[key(rule, h)];
+		e = {value, end, {}};
+		if (value) {
+			e.options.assign(written.begin() + mark, written.end());
+			e.options.emplace_back(value);
+		}
+
+		if (--recording == 0)
+			written.clear();
+	}
+
+	// Sets the options of a result back to those it was parsed with
+	void replay(const entry &e) {
+		for (const options_state &s : e.options) {
+			s.apply();
+			note(s.lptr);
+		}
+	}
+
+	void clear() {
+		map.clear();
+	}
+};
+
+// Holds the memo of a parse while a rule is parsed
+struct memo_scope {
+	memo_table &memo;
+
+	memo_scope(memo_table &memo_) : memo(memo_) {
+		memo.depth++;
+	}
+
+	~memo_scope() {
+		if (--memo.depth == 0)
+			memo.clear();
+	}
+
+	// No copy constructor
+	memo_scope(const memo_scope &) = delete;
+	memo_scope &operator=(const memo_scope &) = delete;
+};
+
+// Dual queue system for parsing and restoring on failure: popping moves
+// 	the cursor of the queue, and restoring moves it back to where
+// 	this queue started (or last received from a nested one)
 struct DualQueue {
 	Queue &q;
-	Queue r;
 
-	DualQueue(Queue &q_) : q(q_) {}
+	// Cursor to restore to
+	token_handle start;
+
+	// Memo of the parse, shared with the nested queues (it lasts
+	// 	until the outermost rule returns, or the queue commits)
+	memo_table *memo;
+
+	DualQueue(Queue &q_) : q(q_), start(q_.cursor()), memo(&_memo) {}
+	DualQueue(Queue &q_, memo_table *memo_)
+			: q(q_), start(q_.cursor()), memo(memo_) {}
 
 	// No copy constructor
 	DualQueue(const DualQueue &) = delete;
@@ -2806,40 +8105,73 @@ struct DualQueue {
 		return q.front();
 	}
 
-	void pop() {
-		if (q.size() > 0) {
-			lexicon lptr = q.front();
-			q.pop_front();
-			r.push_back(lptr);
-		}
+	int front_id() {
+		return q.front_id();
+	}
+
+	// Whether the front token has the id, lexing it first if the queue
+	// 	is fed while it is parsed
+	bool expect(int id) {
+		if (q.feed)
+			return q.feed->next(q, id);
+
+		return q.front_id() == id;
+	}
 
-		// TODO: should throw instead?
+	void pop() {
+		// TODO: should throw if empty instead?
+		q.pop_front();
 	}
 
 	void restore() {
-		while (r.size() > 0) {
-			lexicon lptr = r.back();
-			log_restore(lptr);
-			q.push_front(lptr);
-			r.pop_back();
-		}
+
+#ifdef NABU_DEBUG_PARSER
+
+		for (token_handle h = q.cursor(); h > start; h--)
+			log_restore(q.at(h - 1));
+
+#endif
+
+		q.rewind(start);
 	}
 
+	// Takes over the tokens popped by a nested queue, which then
+	// 	restores only to here
 	void receive(DualQueue &dq) {
 		assert(&dq.q == &q);
-		while (dq.r.size() > 0) {
-			r.push_back(dq.r.front());
-			dq.r.pop_front();
-		}
+		dq.start = q.cursor();
+	}
+
+	// Gives up restoring the tokens popped so far, so the queue can
+	// 	release them (memory then stays bounded by how far a parse
+	// 	can backtrack, when called between top level parses)
+	void commit() {
+		start = q.cursor();
+		q.release(start);
+		memo->clear();
 	}
 
 	bool empty() {
+		if (q.feed)
+			return !q.feed->next(q, -1);
+
 		return q.empty();
 	}
 
+	// Id of the front token to choose alternatives by, -1 at the end
+	// 	and -2 if the queue cannot be looked ahead in
+	int lookahead() {
+		if (q.feed && q.feed->directed())
+			return -2;
+
+		return empty() ? -1 : q.front_id();
+	}
+
 	// Friend
 	template <class ... Args>
 	struct grammar;
+private:
+	memo_table _memo;
 };
 
 // Grammar actions
@@ -2857,15 +8189,43 @@ struct alias {
 	using production_rule = alias <T, Args...>;
 };
 
-// Alternative grammar groups
+// Alternative grammar groups, the alternative which matched is shifted
+// 	into the options of the returned lexicon (so the outermost option
+// 	is in the lowest bits) and shifted out again by its actions
 template <class T, class ... Args>
 struct option {
 	using production_rule = option <T, Args...>;
 
-	// Map of lexicon to option index
-	static std::map <lexicon, int> &map() {
-		static std::map <lexicon, int> m;
-		return m;
+	static constexpr int bits = []() {
+		int b = 1;
+		while ((1 + sizeof...(Args)) > (1u << b))
+			b++;
+
+		return b;
+	}();
+
+	static void push(_lexvalue &lv, int i) {
+		if (lv.options >> (64 - bits)) {
+			if (!lv.spilled)
+				lv.spilled = std::make_unique <std::vector <uint64_t>> ();
+
+			lv.spilled->push_back(lv.options);
+			lv.options = 1;
+		}
+
+		lv.options = (lv.options << bits) | i;
+	}
+
+	static int pop(_lexvalue &lv) {
+		int i = lv.options & ((1u << bits) - 1);
+		lv.options >>= bits;
+
+		if (lv.options == 1 && lv.spilled && !lv.spilled->empty()) {
+			lv.options = lv.spilled->back();
+			lv.spilled->pop_back();
+		}
+
+		return i;
 	}
 };
 
@@ -2879,13 +8239,14 @@ struct repeat {
 template <class T, class ... Args>
 struct execute;
 
+// Executes the actions of consecutive elements, starting at v
 template <class U, class ... V>
-static void exec_step(DualQueue &dq, const vec &v, int i) {
-	execute <U> ::exec(dq, v.at(i));
+static void exec_step(DualQueue &dq, const lexicon *v) {
+	execute <U> ::exec(dq, *v);
 
 	if constexpr (sizeof...(V) > 0) {
 		// Execute nested grammar actions
-		exec_step <V...> (dq, v, i + 1);
+		exec_step <V...> (dq, v + 1);
 	}
 }
 
@@ -2919,8 +8280,8 @@ struct execute {
 			grammar_action <T> ::action(dq, lptr);
 		} else {
 			// Execute nested grammar actions
-			vec v = tovec(lptr);
-			exec_step <T, Args...> (dq, v, 0);
+			const vec &v = children(lptr);
+			exec_step <T, Args...> (dq, v.data());
 
 			log_exec(T, Args...);
 			grammar_action <T, Args...> ::action(dq, lptr);
@@ -2941,8 +8302,8 @@ struct execute <alias <T, Args...>> {
 			grammar_action <alias <T>> ::action(dq, lptr);
 		} else {
 			// Expand lexicon
-			vec v = tovec(lptr);
-			exec_step <T, Args...> (dq, v, 0);
+			const vec &v = children(lptr);
+			exec_step <T, Args...> (dq, v.data());
 
 			// Overall grammar action
 			log_exec(alias <T, Args...>);
@@ -2954,20 +8315,23 @@ struct execute <alias <T, Args...>> {
 // Speciliaze for option
 template <class T, class ... Args>
 struct execute <option <T, Args...>> {
-	static void do_option(DualQueue &dq, const lexicon &lptr, int i) {
-		if (i == 0)
-			return execute <T> ::exec(dq, lptr);
+	using exec_fn = void (*)(DualQueue &, const lexicon &);
 
-		if constexpr (sizeof...(Args) > 0)
-			execute <option <Args...>> ::do_option(dq, lptr, i - 1);
-	}
+	static constexpr exec_fn table[] = {
+		&execute <T> ::exec, &execute <Args> ::exec...
+	};
 
 	static void exec(DualQueue &dq, const lexicon &lptr) {
-		// Never nested, so no need to expand lexicon
-		int i = option <T, Args...> ::map().at(lptr);
+		// Never nested, so no need to expand lexicon; the options
+		// 	nested inside the alternative find theirs next
+		using Option = option <T, Args...>;
+
+		int i = Option::pop(*lptr);
 
 		// Execute single grammar action
-		do_option(dq, lptr, i);
+		table[i](dq, lptr);
+
+		Option::push(*lptr, i);
 
 		// Overall grammar action
 		log_exec(option <T, Args...>);
@@ -2980,11 +8344,11 @@ template <class T, int N>
 struct execute <repeat <T, N>> {
 	static void exec(DualQueue &dq, const lexicon &lptr) {
 		// Always nested, so expand lexicon
-		vec v = tovec(lptr);
+		const vec &v = children(lptr);
 
 		assert(N < 0 || v.size() == N);
-		for (int i = 0; i < v.size(); i++)
-			execute <T> ::exec(dq, v.at(i));
+		for (const lexicon &e : v)
+			execute <T> ::exec(dq, e);
 
 		// Overall grammar action
 		log_exec(repeat <T, N>);
@@ -2992,12 +8356,153 @@ struct execute <repeat <T, N>> {
 	}
 };
 
+template <class T, class ... Args>
+struct grammar;
+
+struct epsilon;
+
+// FIRST set of a grammar: the ids of the tokens a match can start with,
+// 	and whether it can match nothing; grammars which are not tokens
+// 	(or made of them) can start with anything
+struct first_set {
+	std::vector <bool>	ids;
+	bool			nullable = false;
+	bool			any = false;
+
+	void add(int id) {
+		if (id >= (int) ids.size())
+			ids.resize(id + 1);
+
+		ids[id] = true;
+	}
+
+	// Adds the tokens of another set (not whether it is nullable)
+	void merge(const first_set &other) {
+		for (size_t i = 0; i < other.ids.size(); i++) {
+			if (other.ids[i])
+				add(i);
+		}
+
+		any |= other.any;
+	}
+
+	// Whether a match can start with the token (-1 for the end)
+	bool admits(int id) const {
+		return any || nullable || (id >= 0 && id < (int) ids.size() && ids[id]);
+	}
+};
+
+template <class T, class ... Args>
+struct first;
+
+// FIRST set of each grammar, computed once from its production types
+template <class T, class ... Args>
+const first_set &first_of()
+{
+	static const first_set f = first <T, Args...> ::get();
+	return f;
+}
+
+// Sequences
+template <class T, class ... Args>
+struct first {
+	static first_set get() {
+		if constexpr (sizeof...(Args) > 0) {
+			first_set f = first_of <T> ();
+			if (!f.nullable)
+				return f;
+
+			const first_set &rest = first_of <Args...> ();
+			f.merge(rest);
+			f.nullable = rest.nullable;
+			return f;
+		} else {
+			using production_rule = typename T::production_rule;
+
+			first_set f;
+			if constexpr (!std::is_same_v <T, production_rule>)
+				return first_of <production_rule> ();
+			else if constexpr (std::is_same_v <T, epsilon>)
+				f.nullable = true;
+			else if constexpr (token <T> ::id >= 0)
+				f.add(token <T> ::id);
+			else
+				f.any = true;
+
+			return f;
+		}
+	}
+};
+
+template <class T, class ... Args>
+struct first <alias <T, Args...>> {
+	static first_set get() {
+		return first_of <T, Args...> ();
+	}
+};
+
+template <class T, class ... Args>
+struct first <option <T, Args...>> {
+	static first_set get() {
+		first_set f;
+		for (const first_set *alt : {&first_of <T> (), &first_of <Args> ()...}) {
+			f.merge(*alt);
+			f.nullable |= alt->nullable;
+		}
+
+		return f;
+	}
+};
+
+template <class T, int N>
+struct first <repeat <T, N>> {
+	static first_set get() {
+		first_set f = first_of <T> ();
+		f.nullable |= (N <= 0);
+		return f;
+	}
+};
+
+// Parses a rule without its actions, memoized rules are looked up in
+// 	(and added to) the memo of the parse
+template <class T>
+lexicon memo_value(DualQueue &dq)
+{
+	if constexpr (!memoize <T> ::value) {
+		return grammar <T> ::value(dq, false);
+	} else if (dq.q.feed && dq.q.feed->directed()) {
+		// Tokens of directed queues depend on what is expected
+		return grammar <T> ::value(dq, false);
+	} else {
+		int rule = rule_index <T> ();
+		token_handle start = dq.q.cursor();
+
+		if (const memo_table::entry *e = dq.memo->find(rule, start)) {
+			lexicon lptr = e->value;
+
+			// Skip the tokens again, other parses may have set the
+			// 	options of lexicons in the result since
+			if (lptr) {
+				dq.memo->replay(*e);
+				dq.q.rewind(e->end);
+			}
+
+			return lptr;
+		}
+
+		size_t mark = dq.memo->record();
+		lexicon lptr = grammar <T> ::value(dq, false);
+		dq.memo->add(rule, start, lptr, dq.q.cursor(), mark);
+		return lptr;
+	}
+}
+
 // Recursion for grammar
 template <class T, class ... Args>
 struct grammar {
 	template <class U, class ... V>
 	static bool _process(DualQueue &dq, vec &v) {
-		lexicon lptr = grammar <U> ::value(dq, false);
+		lexicon lptr = memo_value <U> (dq);
 		if (lptr) {
 			if constexpr (sizeof...(V) > 0) {
 				if (!_process <V...> (dq, v))
@@ -3012,13 +8517,15 @@ struct grammar {
 	}
 
 	static lexicon value(DualQueue &dq, bool exec = true) {
+		memo_scope scope(*dq.memo);
+
 		if constexpr (sizeof...(Args) == 0) {
 			// Check if T is a pure lexicon
 			using production_rule = typename T::production_rule;
 			if constexpr (!std::is_same_v <T, production_rule>) {
 				// Redirect to rule
 				log_grammar(T);
-				lexicon lptr = grammar <production_rule> ::value(dq, false);
+				lexicon lptr = memo_value <production_rule> (dq);
 				if (!lptr) {
 					log_grammar_end_failure(lptr, T);
 					return nullptr;
@@ -3032,16 +8539,19 @@ struct grammar {
 			}
 
 			// Simple lexicon grammar
-			if (dq.empty())
+			if (!dq.q.feed && dq.empty())
 				return nullptr;
 
 			log_grammar(T);
-			lexicon lptr = dq.front();
-			if (!lptr || lptr->id != token <T> ::id) {
-				log_grammar_end_failure(lptr, T);
+			if (!dq.expect(token <T> ::id)) {
+				log_grammar_end_failure(dq.empty() ? nullptr : dq.front(), T);
 				return nullptr;
 			}
 
+			lexicon lptr = dq.front();
+			lptr->reset_options();
+			dq.memo->note(lptr);
+
 			log_grammar_end_success(lptr, T);
 			if (exec)
 				execute <T> ::exec(dq, lptr);
@@ -3053,8 +8563,18 @@ struct grammar {
 		// Multiple arguments
 		log_grammar(T, Args...);
 
+		// Fail without trying if the next token cannot start it
+		int id = dq.lookahead();
+		if (id != -2 && !first_of <T, Args...> ().admits(id)) {
+			if (exec)
+				dq.restore();
+
+			log_grammar_end_failure(nullptr, T, Args...);
+			return nullptr;
+		}
+
 		vec v;
-		DualQueue dq2(dq.q);
+		DualQueue dq2(dq.q, dq.memo);
 		if (_process <T, Args...> (dq2, v)) {
 			lexicon lptr = make(v);
 			log_grammar_end_success(lptr, T, Args...);
@@ -3093,6 +8613,7 @@ struct grammar <epsilon> {
 template <class T, class ... Args>
 struct grammar <alias <T, Args...>> {
 	static lexicon value(DualQueue &dq, bool exec = true) {
+		memo_scope scope(*dq.memo);
 		log_grammar(alias <T, Args...>);
 
 		lexicon lptr = grammar <T, Args...> ::value(dq, false);
@@ -3111,23 +8632,63 @@ struct grammar <alias <T, Args...>> {
 	}
 };
 
-// Option grammar
+// Option grammar, only the alternatives which can start with the next
+// 	token are tried (in order, so LL(1) grammars never backtrack)
 template <class T, class ... Args>
 struct grammar <option <T, Args...>> {
-	static int _process(DualQueue &dq, lexicon &lptr) {
-		if ((lptr = grammar <T> ::value(dq, false)))
-			return 0;
+	static constexpr size_t size = 1 + sizeof...(Args);
+
+	// Alternatives to try by the id of the next token (offset by one,
+	// 	for the end), and those to try for any token
+	struct dispatch {
+		std::vector <uint64_t>	by_id;
+		uint64_t		always = 0;
+
+		dispatch() {
+			const first_set *alts[] = {&first_of <T> (), &first_of <Args> ()...};
+			for (size_t k = 0; k < size && k < 64; k++) {
+				const first_set &f = *alts[k];
+				if (f.ids.size() + 1 > by_id.size())
+					by_id.resize(f.ids.size() + 1);
+
+				for (size_t i = 0; i < f.ids.size(); i++) {
+					if (f.ids[i])
+						by_id[i + 1] |= uint64_t(1) << k;
+				}
 
-		if constexpr (sizeof...(Args) > 0) {
-			int i = grammar <option <Args...>> ::_process(dq, lptr);
-			if (i >= 0)
-				return i + 1;
+				if (f.any || f.nullable)
+					always |= uint64_t(1) << k;
+			}
+		}
+
+		uint64_t candidates(int id) const {
+			if (id == -2)
+				return ~uint64_t(0);
+
+			size_t i = id + 1;
+			return always | (i < by_id.size() ? by_id[i] : 0);
 		}
+	};
+
+	template <size_t I, class U, class ... V>
+	static int _try(DualQueue &dq, lexicon &lptr, uint64_t mask) {
+		if ((I >= 64 || ((mask >> I) & 1)) && (lptr = memo_value <U> (dq)))
+			return I;
+
+		if constexpr (sizeof...(V) > 0)
+			return _try <I + 1, V...> (dq, lptr, mask);
 
 		return -1;
 	}
 
+	static int _process(DualQueue &dq, lexicon &lptr) {
+		static const dispatch table;
+
+		return _try <0, T, Args...> (dq, lptr, table.candidates(dq.lookahead()));
+	}
+
 	static lexicon value(DualQueue &dq, bool exec = true) {
+		memo_scope scope(*dq.memo);
 		log_grammar(option <T, Args...>);
 
 		lexicon lptr;
@@ -3135,7 +8696,8 @@ struct grammar <option <T, Args...>> {
 		if (i >= 0) {
 			log_grammar_end_success(lptr, option <T, Args...>);
 
-			option <T, Args...> ::map().insert({lptr, i});
+			option <T, Args...> ::push(*lptr, i);
+			dq.memo->note(lptr);
 			if (exec)
 				execute <option <T, Args...>> ::exec(dq, lptr);
 			return lptr;
@@ -3153,15 +8715,16 @@ struct grammar <option <T, Args...>> {
 template <class T, int N>
 struct grammar <repeat <T, N>> {
 	static lexicon value(DualQueue &dq, bool exec = true) {
+		memo_scope scope(*dq.memo);
 		log_grammar(repeat <T, N>);
 
 		vec v;
 		if constexpr (N < 0) {
-			DualQueue dq2(dq.q);
+			DualQueue dq2(dq.q, dq.memo);
 
 			// Repeat until failure (always succeeds)
 			while (true) {
-				lexicon lptr = grammar <T> ::value(dq2, false);
+				lexicon lptr = memo_value <T> (dq2);
 				if (!lptr) {
 					dq2.restore();
 					break;
@@ -3181,9 +8744,9 @@ struct grammar <repeat <T, N>> {
 		}
 
 		// Repeat N times
-		DualQueue dq2(dq.q);
+		DualQueue dq2(dq.q, dq.memo);
 		for (int i = 0; i < N; i++) {
-			lexicon lptr = grammar <T> ::value(dq2, false);
+			lexicon lptr = memo_value <T> (dq2);
 			if (!lptr) {
 				dq2.restore();
 				if (exec)
@@ -3254,7 +8817,7 @@ inline std::string pretty_lexvec(const std::vector <parser::lexicon> &v, int ind
                 // Check if it is a lexvec
                 if (v[i]->id == parser::token <std::vector <parser::lexicon>> ::id) {
                         s += pretty_lexvec(
-                                tovec(v[i]),
+                                parser::children(v[i]),
                                 indent + 1
                         );
                 } else {
@@ -5,14 +5,6 @@
 
 #include <nabu.hpp>
 
-////////////////////////
-// Lexicon converters //
-////////////////////////
-
-inline std::string to_string(const std::string &s) {
-	return s;
-}
-
 ///////////////////////
 // Lexical strutures //
 ///////////////////////
@@ -21,9 +13,9 @@ inline std::string to_string(const std::string &s) {
 struct identifier {};
 struct str {};
 
-// TODO: Is the string -> string any use?
-auto_mk_overloaded_token(identifier, "[a-zA-Z_][a-zA-Z0-9_]*", std::string, to_string);
-auto_mk_overloaded_token(str, "\".*\"", std::string, to_string);
+// Text is read with get <std::string> or get <std::string_view>
+auto_mk_token(identifier, "[a-zA-Z_][a-zA-Z0-9_]*");
+auto_mk_token(str, "\".*\"");
 
 // Structural tokens
 struct macro {};
@@ -31,9 +23,9 @@ struct fargs {};
 struct fbody {};
 
 // TODO: mk_token should create a struct, auto_token is using the struct
-auto_mk_overloaded_token(macro, "@[a-zA-Z_][a-zA-Z0-9_-]*", std::string, to_string);
-auto_mk_overloaded_token(fargs, "\\(.*\\)", std::string, to_string);
-auto_mk_overloaded_token(fbody, "\\{", std::string, to_string);
+auto_mk_token(macro, "@[a-zA-Z_][a-zA-Z0-9_-]*");
+auto_mk_token(fargs, "\\(.*\\)");
+auto_mk_token(fbody, "\\{");
 
 // Operators
 struct action {};
@@ -0,0 +1,110 @@
+// Damaged lexer cache images are rejected and the automaton is compiled
+// 	again; also checks that nabu.hpp declares no global close
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+
+nabu_terminal(kwif);
+nabu_terminal(close);
+nabu_terminal(ws);
+
+auto_mk_token(kwif, "if");
+auto_mk_token(close, "[a-z]+");
+auto_mk_token(ws, " +");
+
+lexlist_next(kwif, close);
+lexlist_next(close, ws);
+
+ignore(ws);
+
+lexer_engine(kwif, nabu::parser::dfa_engine);
+
+#define CACHE "nabu_test_cache.dfa"
+
+lexer_cache_file(kwif, CACHE);
+
+bool write(const std::string &image)
+{
+	std::ofstream out(CACHE, std::ios::binary | std::ios::trunc);
+	out.write(image.data(), image.size());
+	return (bool) out;
+}
+
+bool loads(const std::string &image)
+{
+	dfa::tables t;
+	dfa::keywords kw;
+	dfa::mapped_file file;
+
+	return write(image) && file.open(CACHE)
+		&& dfa::load(file, dfa_fingerprint <kwif> (), 3, t, kw);
+}
+
+void set(std::string &image, size_t offset, int32_t value)
+{
+	memcpy(&image[offset], &value, sizeof(value));
+}
+
+int main()
+{
+	bool ok = true;
+
+	std::remove(CACHE);
+	if (!dfa::save(compile_dfa <kwif> (), dfa_fingerprint <kwif> (), CACHE))
+		return 1;
+
+	std::string image;
+	{
+		std::ifstream in(CACHE, std::ios::binary);
+		image.assign(std::istreambuf_iterator <char> (in),
+			std::istreambuf_iterator <char> ());
+	}
+
+	dfa::image_header h;
+	memcpy(&h, image.data(), sizeof(h));
+
+	size_t accept = sizeof(h) + 256 + (size_t) h.nstates * h.nclasses * 4;
+	size_t keywords = accept + h.nstates * 4;
+
+	if (!loads(image) || h.nkeywords != 1) {
+		printf("cache: the saved image is not loaded\n");
+		ok = false;
+	}
+
+	// An accepted token past the lexlist, a keyword of no token and a
+	// 	truncated image
+	std::string bad_accept = image;
+	set(bad_accept, accept + 4 * (h.nstates - 1), 3);
+
+	std::string bad_keyword = image;
+	set(bad_keyword, keywords, 7);
+
+	std::string truncated = image.substr(0, image.size() - 4);
+	set(truncated, offsetof(dfa::image_header, size), truncated.size());
+
+	for (const std::string &bad : {bad_accept, bad_keyword, truncated}) {
+		if (loads(bad)) {
+			printf("cache: a damaged image is loaded\n");
+			ok = false;
+		}
+	}
+
+	// The lexer compiles the automaton again over the damaged image
+	write(bad_keyword);
+
+	Queue q = lexq <kwif> (std::string("if iff close"));
+	std::string ids;
+	for (const lexicon &lptr : q)
+		ids += (lptr->id == token <kwif> ::id) ? "k" : "c";
+
+	if (ids != "kcc") {
+		printf("cache: tokens \"%s\"\n", ids.c_str());
+		ok = false;
+	}
+
+	std::remove(CACHE);
+
+	printf("cache: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
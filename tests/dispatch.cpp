@@ -0,0 +1,166 @@
+// Options and sequences dispatched on the FIRST sets of the next token
+// 	parse as they do when every alternative is tried, also with
+// 	nullable and epsilon alternatives, keywords that are also
+// 	identifiers and more alternatives than the dispatch table holds
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+using namespace nabu::parser::rd;
+
+nabu_terminal(kwif);
+nabu_terminal(ident);
+nabu_terminal(num);
+nabu_terminal(lpar);
+nabu_terminal(rpar);
+nabu_terminal(ws);
+
+auto_mk_token(kwif, "if");
+auto_mk_token(ident, "[a-z]+");
+auto_mk_token(num, "[0-9]+");
+auto_mk_token(lpar, "\\(");
+auto_mk_token(rpar, "\\)");
+auto_mk_token(ws, " +");
+
+lexlist_next(kwif, ident);
+lexlist_next(ident, num);
+lexlist_next(num, lpar);
+lexlist_next(lpar, rpar);
+lexlist_next(rpar, ws);
+
+ignore(ws);
+
+namespace nabu::parser::rd {
+
+struct maybe_num { using production_rule = option <num, epsilon>; };
+struct call { using production_rule = alias <ident, lpar, maybe_num, rpar>; };
+struct cond { using production_rule = alias <kwif, ident>; };
+struct headed { using production_rule = alias <maybe_num, ident>; };
+
+// Nullable last alternative, tried for any token
+struct stmt {
+	using production_rule = option <cond, call, headed,
+		alias <lpar, stmt, rpar>, maybe_num>;
+};
+
+// Alternatives after epsilon are never reached
+struct eps { using production_rule = option <alias <num, num>, epsilon, ident>; };
+
+// Keywords are identifiers too
+struct word { using production_rule = option <alias <ident, lpar>, ident, kwif>; };
+struct name { using production_rule = option <call, alias <word, word>, cond>; };
+
+// Alternatives from the 65th on are always tried
+template <size_t I>
+struct pad { using production_rule = alias <num, num>; };
+
+template <size_t ... I>
+option <pad <I>..., ident, kwif, alias <lpar, ident>> wide_of(std::index_sequence <I...>);
+
+struct wide { using production_rule = decltype(wide_of(std::make_index_sequence <64> ())); };
+
+}
+
+std::string trace;
+
+#define trace_action(T, str)						\
+	template <>							\
+	struct nabu::parser::rd::grammar_action <T> {			\
+		static void action(DualQueue &, const lexicon &) {	\
+			trace += str;					\
+		}							\
+	};
+
+trace_action(kwif, "K")
+trace_action(ident, "I")
+trace_action(num, "N")
+trace_action(lpar, "(")
+trace_action(rpar, ")")
+trace_action(epsilon, "e")
+trace_action(maybe_num, "m")
+trace_action(call, "c")
+trace_action(cond, "?")
+trace_action(headed, "h")
+trace_action(stmt, "s")
+trace_action(eps, "E")
+trace_action(word, "w")
+trace_action(name, "n")
+trace_action(wide, "W")
+
+// Feed of a queue lexed up front which the parser cannot look ahead
+// 	in, so no alternative is skipped (nor memoized)
+struct blind_feed : token_feed {
+	bool next(Queue &q, int id) override {
+		return !q.empty() && (id == -1 || q.front_id() == id);
+	}
+
+	bool directed() const override {
+		return true;
+	}
+};
+
+// Actions run and tokens left by a parse of the source
+template <class Rule>
+std::string parse(const std::string &source, bool dispatch)
+{
+	Queue q = lexq <kwif> (source);
+	if (!dispatch)
+		q.feed = std::make_shared <blind_feed> ();
+
+	DualQueue dq(q);
+
+	trace.clear();
+	lexicon lptr = grammar <Rule> ::value(dq);
+	return (lptr ? trace : "fail") + " | " + std::to_string(q.size());
+}
+
+template <class Rule>
+bool check(const std::string &name, const std::vector <std::string> &sources)
+{
+	for (const std::string &source : sources) {
+		std::string expected = parse <Rule> (source, false);
+		std::string got = parse <Rule> (source, true);
+		if (got != expected) {
+			printf("dispatch: %s of \"%s\" is %s instead of %s\n",
+				name.c_str(), source.c_str(),
+				got.c_str(), expected.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main()
+{
+	// Every source of up to four tokens
+	const std::vector <std::string> pieces = {"if", "x", "1", "(", ")"};
+
+	std::vector <std::string> sources = {""};
+	for (size_t begin = 0, end = 1; end - begin < 1000; ) {
+		for (size_t i = begin; i < end; i++) {
+			for (const std::string &p : pieces)
+				sources.push_back(sources[i] + " " + p);
+		}
+
+		begin = end;
+		end = sources.size();
+	}
+
+	bool ok = true;
+	ok &= check <stmt> ("stmt", sources);
+	ok &= check <eps> ("eps", sources);
+	ok &= check <name> ("name", sources);
+	ok &= check <wide> ("wide", sources);
+
+	// The alternatives past the table are reached
+	for (const std::string &source : {"if", "x", "( x"}) {
+		if (parse <wide> (source, true).find("W") == std::string::npos) {
+			printf("dispatch: wide fails on \"%s\"\n", source.c_str());
+			ok = false;
+		}
+	}
+
+	printf("dispatch: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
@@ -0,0 +1,137 @@
+// Memoized rules must parse (and run actions) exactly like plain ones,
+// 	also when their tokens were parsed again by other alternatives
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+using namespace nabu::parser::rd;
+
+nabu_terminal(num);
+nabu_terminal(plus);
+nabu_terminal(lp);
+nabu_terminal(rp);
+nabu_terminal(ident);
+nabu_terminal(semi);
+nabu_terminal(star);
+nabu_terminal(sp);
+
+auto_mk_overloaded_token(num, "[0-9]+", int, std::stoi);
+auto_mk_token(plus, "\\+");
+auto_mk_token(lp, "\\(");
+auto_mk_token(rp, "\\)");
+auto_mk_token(ident, "[0-9a-z]+");
+auto_mk_token(semi, ";");
+auto_mk_token(star, "\\*");
+auto_mk_token(sp, " +");
+
+lexlist_next(num, plus);
+lexlist_next(plus, lp);
+lexlist_next(lp, rp);
+lexlist_next(rp, ident);
+lexlist_next(ident, semi);
+lexlist_next(semi, star);
+lexlist_next(star, sp);
+
+ignore(sp);
+
+// The same grammar twice, only the second one is memoized
+namespace nabu::parser::rd {
+
+struct expr;
+struct term { using production_rule = option <alias <lp, expr, rp>, num>; };
+struct expr { using production_rule = option <alias <term, plus, expr>, term>; };
+
+struct mexpr;
+struct mterm { using production_rule = option <alias <lp, mexpr, rp>, num>; };
+struct mexpr { using production_rule = option <alias <mterm, plus, mexpr>, mterm>; };
+
+// An alternative between two uses of a statement parses its number again
+struct value { using production_rule = option <num, ident>; };
+struct stmt { using production_rule = alias <value, semi>; };
+struct line {
+	using production_rule = option <alias <stmt, star>, alias <num, num>, alias <stmt, plus>>;
+};
+
+struct mstmt { using production_rule = alias <value, semi>; };
+struct mline {
+	using production_rule = option <alias <mstmt, star>, alias <num, num>, alias <mstmt, plus>>;
+};
+
+}
+
+memoize(nabu::parser::rd::mterm);
+memoize(nabu::parser::rd::mexpr);
+memoize(nabu::parser::rd::mstmt);
+
+std::string trace;
+
+template <>
+struct nabu::parser::rd::grammar_action <num> {
+	static void action(DualQueue &, const lexicon &lptr) {
+		trace += std::to_string(get <int> (lptr)) + " ";
+	}
+};
+
+template <>
+struct nabu::parser::rd::grammar_action <ident> {
+	static void action(DualQueue &, const lexicon &lptr) {
+		trace += "id " + std::string(lptr->text) + " ";
+	}
+};
+
+template <>
+struct nabu::parser::rd::grammar_action <plus> {
+	static void action(DualQueue &, const lexicon &) {
+		trace += "+ ";
+	}
+};
+
+template <class Rule>
+std::string parse(const std::string &source)
+{
+	trace.clear();
+
+	Queue q = lexq <num> (source);
+	DualQueue dq(q);
+
+	lexicon lptr = grammar <Rule> ::value(dq);
+
+	// The memo only lasts for the parse
+	if (!dq.memo->map.empty())
+		return "memo kept";
+
+	if (!lptr)
+		return "failed";
+
+	return lptr->str() + " | " + trace + "| left " + std::to_string(q.size());
+}
+
+int main()
+{
+	const char *sources[] = {
+		"1",
+		"1 + 2",
+		"(1 + (2 + 3)) + 4",
+		"((((1 + 2) + 3) + 4) + 5)",
+		"(1 + 2",
+	};
+
+	int failures = 0;
+	auto compare = [&](const char *source, const std::string &plain,
+			const std::string &memo) {
+		if (plain != memo) {
+			printf("memoize: \"%s\"\n\t%s\n\t%s\n", source,
+				plain.c_str(), memo.c_str());
+			failures++;
+		}
+	};
+
+	for (const char *source : sources)
+		compare(source, parse <expr> (source), parse <mexpr> (source));
+
+	for (const char *source : {"5 ; +", "x ; +", "5 ; *", "5 5"})
+		compare(source, parse <line> (source), parse <mline> (source));
+
+	printf("memoize: %s\n", failures ? "FAILED" : "OK");
+	return failures != 0;
+}
@@ -0,0 +1,90 @@
+// Nested options run the actions of the alternatives which matched, also
+// 	when several of them return the same lexicon (more than fit in
+// 	one word of options)
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+using namespace nabu::parser::rd;
+
+nabu_terminal(a);
+nabu_terminal(b);
+nabu_terminal(c);
+nabu_terminal(d);
+nabu_terminal(sp);
+
+auto_mk_token(a, "a");
+auto_mk_token(b, "b");
+auto_mk_token(c, "c");
+auto_mk_token(d, "d");
+auto_mk_token(sp, " +");
+
+lexlist_next(a, b);
+lexlist_next(b, c);
+lexlist_next(c, d);
+lexlist_next(d, sp);
+
+ignore(sp);
+
+namespace nabu::parser::rd {
+
+struct inner { using production_rule = option <a, b, c>; };
+struct mid { using production_rule = option <alias <d, d>, inner>; };
+struct outer { using production_rule = option <alias <a, a, a>, mid, alias <mid, d>>; };
+
+// Options nested N deep on one token (two bits each), taking the
+// 	alternatives in turn
+template <int N>
+struct deep {
+	using production_rule = std::conditional_t <N % 3 == 0,
+		option <deep <N - 1>, b, c>, std::conditional_t <N % 3 == 1,
+		option <b, deep <N - 1>, c>, option <b, c, deep <N - 1>>>>;
+};
+
+template <>
+struct deep <0> { using production_rule = option <b, c, a>; };
+
+}
+
+std::string trace;
+
+#define trace_action(T, str)						\
+	template <>							\
+	struct nabu::parser::rd::grammar_action <T> {			\
+		static void action(DualQueue &, const lexicon &) {	\
+			trace += str;					\
+		}							\
+	};
+
+trace_action(a, "A")
+trace_action(b, "B")
+trace_action(c, "C")
+trace_action(d, "D")
+trace_action(inner, "i")
+trace_action(mid, "m")
+trace_action(outer, "o ")
+
+int main()
+{
+	Queue q = lexq <a> ("a a a b c d d a c d b d");
+	DualQueue dq(q);
+
+	grammar <repeat <outer>> ::value(dq);
+
+	std::string expected = "AAAo Bimo Cimo DDmo Aimo Cimo ";
+	bool ok = (trace == expected && q.size() == 3);
+	if (!ok)
+		printf("options: \"%s\" (%zu left)\n", trace.c_str(), q.size());
+
+	trace.clear();
+
+	Queue q2 = lexq <a> ("a");
+	DualQueue dq2(q2);
+	if (!grammar <deep <40>> ::value(dq2) || trace != "A") {
+		printf("options: \"%s\" for deep options\n", trace.c_str());
+		ok = false;
+	}
+
+	printf("options: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
@@ -0,0 +1,105 @@
+// Lexing on several threads gives the queue, reach and gap errors of
+// 	lexq, whatever the chunk size, also for std_engine lexlists
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+
+nabu_terminal(kwif);
+nabu_terminal(ident);
+nabu_terminal(num);
+nabu_terminal(comment);
+nabu_terminal(ws);
+
+auto_mk_token(kwif, "if");
+auto_mk_token(ident, "[a-z]+");
+auto_mk_token(num, "[0-9]+");
+auto_mk_token(comment, "/\\*([^*]|\\*+[^*/])*\\*+/");
+auto_mk_token(ws, "[ \\n]+");
+
+lexlist_next(kwif, ident);
+lexlist_next(ident, num);
+lexlist_next(num, comment);
+lexlist_next(comment, ws);
+
+ignore(comment);
+ignore(ws);
+
+lexer_engine(kwif, nabu::parser::dfa_engine);
+
+// The same tokens with std::regex, where the first alternative wins
+nabu_terminal(skwif);
+nabu_terminal(sident);
+nabu_terminal(snum);
+nabu_terminal(sws);
+
+auto_mk_token(skwif, "if");
+auto_mk_token(sident, "[a-z]+");
+auto_mk_token(snum, "[0-9]+");
+auto_mk_token(sws, "[ \\n]+");
+
+lexlist_next(skwif, sident);
+lexlist_next(sident, snum);
+lexlist_next(snum, sws);
+
+ignore(sws);
+
+lexer_engine(skwif, nabu::parser::std_engine);
+
+// Tokens with their spans and reach, then the errors
+std::string dump(const Queue &q, const diagnostics &diag)
+{
+	std::string out;
+	for (token_handle h = q.base(); h < q.handles(); h++) {
+		out += std::to_string(q.id_at(h)) + "@" + std::to_string(q.offset(h))
+			+ "+" + std::to_string(q.length(h))
+			+ "<" + std::to_string(q.reach(h)) + " ";
+	}
+
+	for (const diagnostic &d : diag.list)
+		out += "\n" + std::to_string(d.line) + ":" + std::to_string(d.col) + " " + d.text;
+
+	return out;
+}
+
+template <class Head>
+bool check(const std::string &name, const std::string &text)
+{
+	auto source = std::make_shared <const std::string> (text);
+
+	diagnostics expected_diag;
+	std::string expected = dump(lexq <Head> (source, &expected_diag), expected_diag);
+
+	bool ok = true;
+	for (size_t chunk : {1, 2, 3, 7, 16, 64, 1 << 20}) {
+		for (unsigned threads : {2, 4}) {
+			diagnostics diag;
+			Queue q = lexq_parallel <Head> (source, threads, chunk, &diag);
+			if (dump(q, diag) != expected) {
+				printf("parallel: %s differs with %u threads, chunks of %zu\n",
+					name.c_str(), threads, chunk);
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+int main()
+{
+	std::string text;
+	for (int i = 0; i < 50; i++) {
+		text += "if x" + std::to_string(i) + " iff /* a\n * b\n */ 12\n";
+		text += (i % 7 == 0) ? "@@ if\n" : "ident\n";
+		text += (i % 11 == 0) ? "/* open\n\n" : "\n";
+	}
+
+	bool ok = true;
+	ok &= check <kwif> ("dfa", text);
+	ok &= check <kwif> ("dfa, unterminated comment", text + "/* never closed\nif");
+	ok &= check <skwif> ("std", text);
+
+	printf("parallel: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
@@ -0,0 +1,135 @@
+// Queues lexed on another thread through a small ring give the tokens
+// 	and errors of lexq, also with an error handler that returns
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+using namespace nabu::parser::rd;
+
+nabu_terminal(kwif);
+nabu_terminal(ident);
+nabu_terminal(num);
+nabu_terminal(ws);
+
+auto_mk_token(kwif, "if");
+auto_mk_token(ident, "[a-z]+");
+auto_mk_token(num, "[0-9]+");
+auto_mk_token(ws, "[ \\n]+");
+
+lexlist_next(kwif, ident);
+lexlist_next(ident, num);
+lexlist_next(num, ws);
+
+ignore(ws);
+
+lexer_engine(kwif, nabu::parser::dfa_engine);
+
+// Words, and raw text between braces in a second mode
+nabu_terminal(word);
+nabu_terminal(sp);
+nabu_terminal(lbrace);
+nabu_terminal(raw);
+nabu_terminal(rbrace);
+
+auto_mk_token(word, "[a-z]+");
+auto_mk_token(sp, "[ \\n]+");
+auto_mk_token(lbrace, "\\{");
+auto_mk_token(raw, "[^{}@]+");
+auto_mk_token(rbrace, "\\}");
+
+lexlist_next(word, sp);
+lexlist_next(sp, lbrace);
+
+lexlist_next(raw, rbrace);
+
+ignore(sp);
+
+lexer_push(lbrace, raw);
+lexer_pop(rbrace);
+
+// Errors of the lexers without diagnostics, which go on lexing
+std::string handled;
+
+template <>
+void nabu::parser::lerror_handler <kwif> (const std::string &err,
+		const line_index &, int line, int col)
+{
+	handled += err + "@" + std::to_string(line) + ":" + std::to_string(col) + " ";
+}
+
+template <>
+void nabu::parser::lerror_handler <raw> (const std::string &err,
+		const line_index &, int line, int col)
+{
+	handled += "raw " + err + "@" + std::to_string(line) + ":" + std::to_string(col) + " ";
+}
+
+// Tokens of a queue, all of them lexed, then the errors
+std::string dump(Queue &q, const diagnostics &diag)
+{
+	DualQueue dq(q);
+	while (dq.expect(-1))
+		dq.pop();
+
+	std::string out;
+	for (token_handle h = q.base(); h < q.handles(); h++) {
+		out += std::to_string(q.id_at(h)) + "@" + std::to_string(q.offset(h))
+			+ "+" + std::to_string(q.length(h)) + " ";
+	}
+
+	for (const diagnostic &d : diag.list)
+		out += "\n" + std::to_string(d.line) + ":" + std::to_string(d.col) + " " + d.text;
+
+	return out + "\n" + handled;
+}
+
+template <class Head>
+bool check(const std::string &name, const std::string &text)
+{
+	auto source = std::make_shared <const std::string> (text);
+
+	bool ok = true;
+	for (bool recover : {true, false}) {
+		handled.clear();
+
+		diagnostics expected_diag;
+		Queue e = lexq <Head> (source, recover ? &expected_diag : nullptr);
+		std::string expected = dump(e, expected_diag);
+
+		for (size_t capacity : {1, 2, 3, 16}) {
+			handled.clear();
+
+			diagnostics diag;
+			Queue q = lexq_pipelined <Head> (source, capacity,
+				recover ? &diag : nullptr);
+			if (dump(q, diag) != expected) {
+				printf("pipeline: %s differs with a ring of %zu%s\n",
+					name.c_str(), capacity,
+					recover ? ", recovering" : "");
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+int main()
+{
+	std::string text;
+	std::string modes;
+	for (int i = 0; i < 100; i++) {
+		text += "if x" + std::to_string(i) + " iff 12\n";
+		text += (i % 7 == 0) ? "@@ if $\n" : "y\n";
+
+		modes += "abc { int x; " + std::string((i % 5 == 0) ? "@@ " : "")
+			+ "} def\n";
+	}
+
+	bool ok = true;
+	ok &= check <kwif> ("dfa", text);
+	ok &= check <word> ("modes", modes);
+
+	printf("pipeline: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
@@ -0,0 +1,76 @@
+// Keywords spelled by an ignored run of the prefilter are still lexed as
+// 	keywords, with the runtime and the compile-time DFA
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+
+nabu_terminal(pif);
+nabu_terminal(ident);
+nabu_terminal(comment);
+nabu_terminal(ws);
+
+auto_mk_token(pif, "#if");
+auto_mk_token(ident, "[a-z]+");
+auto_mk_token(comment, "#[^\\n]*");
+auto_mk_token(ws, "[ \\n]+");
+
+lexlist_next(pif, ident);
+lexlist_next(ident, comment);
+lexlist_next(comment, ws);
+
+ignore(comment);
+ignore(ws);
+
+lexer_engine(pif, nabu::parser::dfa_engine);
+
+nabu_terminal(spif);
+nabu_terminal(sident);
+nabu_terminal(scomment);
+nabu_terminal(sws);
+
+auto_mk_token(spif, "#if");
+auto_mk_token(sident, "[a-z]+");
+auto_mk_token(scomment, "#[^\\n]*");
+auto_mk_token(sws, "[ \\n]+");
+
+lexlist_next(spif, sident);
+lexlist_next(sident, scomment);
+lexlist_next(scomment, sws);
+
+ignore(scomment);
+ignore(sws);
+
+lexer_engine(spif, nabu::parser::static_engine);
+
+// Tokens as "text " with keywords in brackets
+template <class Head>
+std::string tokens(const std::string &source)
+{
+	Queue q = lexq <Head> (source);
+
+	std::string out;
+	for (const lexicon &lptr : q) {
+		std::string text(lptr->text);
+		out += (lptr->id == token <Head> ::id) ? "[" + text + "] " : text + " ";
+	}
+
+	return out;
+}
+
+int main()
+{
+	const std::string source = "#if\nx\n#if y\n#ifz\n#if";
+	const std::string expected = "[#if] x [#if] ";
+
+	bool ok = true;
+	for (const std::string &out : {tokens <pif> (source), tokens <spif> (source)}) {
+		if (out != expected) {
+			printf("prefilter: \"%s\"\n", out.c_str());
+			ok = false;
+		}
+	}
+
+	printf("prefilter: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}
@@ -0,0 +1,170 @@
+// Chains of edits re-lexed incrementally give the queue of a fresh lexq
+// 	of the edited source, also for edits inside ignored comments,
+// 	inside keywords and across lexer modes
+#include <random>
+
+#include "nabu.hpp"
+
+using namespace nabu;
+using namespace nabu::parser;
+
+nabu_terminal(kwif);
+nabu_terminal(ident);
+nabu_terminal(num);
+nabu_terminal(comment);
+nabu_terminal(ws);
+
+auto_mk_token(kwif, "if");
+auto_mk_token(ident, "[a-z]+");
+auto_mk_token(num, "[0-9]+");
+auto_mk_token(comment, "/\\*([^*]|\\*+[^*/])*\\*+/");
+auto_mk_token(ws, "[ \\n]+");
+
+lexlist_next(kwif, ident);
+lexlist_next(ident, num);
+lexlist_next(num, comment);
+lexlist_next(comment, ws);
+
+ignore(comment);
+ignore(ws);
+
+lexer_engine(kwif, nabu::parser::dfa_engine);
+
+// Words, and raw text between braces in a second mode
+nabu_terminal(word);
+nabu_terminal(sp);
+nabu_terminal(lbrace);
+nabu_terminal(raw);
+nabu_terminal(rbrace);
+nabu_terminal(nested);
+
+auto_mk_token(word, "[a-z]+");
+auto_mk_token(sp, "[ \\n]+");
+auto_mk_token(lbrace, "\\{");
+auto_mk_token(raw, "[^{}]+");
+auto_mk_token(rbrace, "\\}");
+auto_mk_token(nested, "\\{");
+
+lexlist_next(word, sp);
+lexlist_next(sp, lbrace);
+
+lexlist_next(raw, rbrace);
+lexlist_next(rbrace, nested);
+
+ignore(sp);
+
+lexer_push(lbrace, raw);
+lexer_pop(rbrace);
+lexer_push(nested, raw);
+
+// Tokens with their spans, reach and positions
+std::string dump(const Queue &q)
+{
+	std::string out;
+	for (token_handle h = q.base(); h < q.handles(); h++) {
+		const lexicon &lptr = q.at(h);
+		out += std::to_string(q.id_at(h)) + "@" + std::to_string(q.offset(h))
+			+ "+" + std::to_string(q.length(h))
+			+ "<" + std::to_string(q.reach(h))
+			+ ":" + std::to_string(lptr->line) + ":" + std::to_string(lptr->col)
+			+ " ";
+	}
+
+	return out;
+}
+
+// Applies the edits one after the other to a queue and a copy of its
+// 	source, checking the queue after each of them
+template <class Head>
+bool check(const std::string &name, std::string source,
+		const std::vector <std::tuple <size_t, size_t, std::string>> &edits)
+{
+	diagnostics diag;
+	Queue q = lexq <Head> (source, diag);
+
+	for (size_t i = 0; i < edits.size(); i++) {
+		const auto &[offset, removed, inserted] = edits[i];
+		relex <Head> (q, offset, removed, inserted, &diag);
+		source.replace(offset, removed, inserted);
+
+		diagnostics fresh_diag;
+		if (dump(q) != dump(lexq <Head> (source, fresh_diag))) {
+			printf("relex: %s differs after edit %zu\n", name.c_str(), i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Random edits of a source with the given pieces
+template <class Head>
+bool fuzz(const std::string &name, std::string source,
+		const std::vector <std::string> &pieces)
+{
+	std::mt19937 rng(7);
+
+	std::vector <std::tuple <size_t, size_t, std::string>> edits;
+	size_t size = source.size();
+	for (int i = 0; i < 200; i++) {
+		size_t offset = rng() % (size + 1);
+		size_t removed = std::min <size_t> (rng() % 4, size - offset);
+		std::string inserted = (rng() % 3) ? pieces[rng() % pieces.size()] : "";
+
+		edits.push_back({offset, removed, inserted});
+		size += inserted.size() - removed;
+	}
+
+	return check <Head> (name, source, edits);
+}
+
+int main()
+{
+	const std::string source = "if x /* a if\n b */ 12 iff\nif /* c */ y 3\n";
+
+	bool ok = true;
+
+	ok &= check <kwif> ("comment", source, {
+		{8, 0, "*/ x /*"},		// Closes the comment early
+		{9, 2, ""},			// Reopens it
+		{7, 4, "if"},			// Edits inside it
+		{6, 3, ""},			// Drops its start
+		{0, 0, "/*"},			// Comments out the rest
+		{0, 2, ""}
+	});
+
+	ok &= check <kwif> ("keyword", source, {
+		{1, 0, "f"},			// "iff", an identifier
+		{1, 1, ""},			// "if" again
+		{0, 1, ""},			// "f"
+		{0, 0, "i"},
+		{24, 1, ""},			// "iff" on the second line
+		{25, 0, "\n"}			// "i\nf"
+	});
+
+	ok &= check <kwif> ("errors", source, {
+		{3, 0, "@@"},
+		{4, 1, "x"},
+		{3, 3, ""},
+		{source.size() - 1, 0, "/* open"}
+	});
+
+	ok &= fuzz <kwif> ("kwif fuzz", source,
+		{"if", "i", "f", "/*", "*/", "*", " ", "\n", "9", "@", "x"});
+
+	const std::string modes = "abc { int x; {y} z } def\n{a b}\n}} e";
+
+	ok &= check <word> ("modes", modes, {
+		{4, 1, ""},			// Drops a brace
+		{4, 0, "{"},			// Puts it back
+		{15, 0, "}"},			// Closes the mode early
+		{0, 0, "{"},			// Everything raw
+		{0, 1, ""}
+	});
+
+	ok &= fuzz <word> ("modes fuzz", modes,
+		{"{", "}", "a", " ", "\n", "xy", "@"});
+
+	printf("relex: %s\n", ok ? "OK" : "FAILED");
+	return !ok;
+}